@@ -0,0 +1,956 @@
+#include "benchmark.h"
+
+#include <QAbstractEventDispatcher>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QtConcurrent>
+#include <QThread>
+#include <QPainter>
+#include <QTimer>
+#include <QVector>
+#include <QWidget>
+
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <cstdlib>
+#include <new>
+
+#include "caret_overlay.h"
+#include "frame_renderer.h"
+#include "gl_text_renderer.h"
+#include "glyph_atlas.h"
+#include "layout_cache.h"
+#include "line_cache.h"
+#include "row_tile_cache.h"
+#include "shaping_cache.h"
+#include "style_map.h"
+#include "theme.h"
+#include "text_line.h"
+#include "wrap_index.h"
+
+// XI_ALLOC_STATS (see src.pro) counts every heap allocation of the process
+#ifdef XI_ALLOC_STATS
+static std::atomic<qint64> s_allocations(0);
+
+#ifdef __GLIBC__
+// the executable's malloc interposes the one Qt's libraries call, so QString and
+// QVector storage is counted along with operator new, which ends up here too
+extern "C" {
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+
+void *malloc(std::size_t size) noexcept {
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t count, std::size_t size) noexcept {
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, std::size_t size) noexcept {
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+#else
+void *operator new(std::size_t size) {
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+#endif
+#endif
+
+namespace xi {
+
+static qint64 allocations() {
+#ifdef XI_ALLOC_STATS
+    return s_allocations.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+Benchmark *Benchmark::shared() {
+    static Benchmark benchmark;
+    return &benchmark;
+}
+
+void Benchmark::run() {
+    decodeInsert();
+    styleApplication();
+    scrollFrames();
+    openGLFrames();
+    frameBands();
+    snapshotAcquisition();
+    themeAccess();
+    themeSwitch();
+    tokenShaping();
+    editSession();
+    styleDefinitions();
+    longLine();
+    wrapIndex();
+    idleWakeups();
+    caretBlink();
+}
+
+// one ins op carrying 200k styled lines, decoded with 1..N threads
+void Benchmark::decodeInsert() {
+    constexpr auto kLines = 200'000;
+
+    QJsonArray jsonLines;
+    for (auto i = 0; i < kLines; ++i) {
+        QJsonObject line;
+        line["text"] = QString("    let v%1 = format!(\"{} été {}\", a%1, b%1); // über\n").arg(i);
+        line["styles"] = QJsonArray{0, 7, 2, 1, 3, 3, 3, 3, 4, 3, 7, 5, 20, 15, 6};
+        line["ln"] = i + 1;
+        jsonLines.append(line);
+    }
+    QJsonObject op;
+    op["op"] = "ins";
+    op["n"] = kLines;
+    op["lines"] = jsonLines;
+    QJsonObject update;
+    update["ops"] = QJsonArray{op};
+
+    QVector<int> threadCounts;
+    auto maxThreads = QThread::idealThreadCount();
+    for (auto threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.append(threads);
+    }
+    threadCounts.append(maxThreads);
+
+    qint64 serial = 0;
+    foreach (int threads, threadCounts) {
+        LineCacheState cache;
+        QElapsedTimer timer;
+        timer.start();
+        cache.applyUpdate(update, threads);
+        auto elapsed = timer.nsecsElapsed() / 1000;
+        if (threads == 1) serial = elapsed;
+        qDebug() << "decode" << kLines << "lines:" << threads << "threads"
+                 << elapsed / 1000.0 << "ms, speedup" << qreal(serial) / qMax<qint64>(1, elapsed);
+    }
+}
+
+// 10k lines with a run every few characters, decoded then applied to builders
+void Benchmark::styleApplication() {
+    constexpr auto kLines = 10'000;
+    constexpr auto kStyles = 16;
+
+    auto styleMap = std::make_shared<StyleMapState>();
+    for (auto id = 2; id < kStyles + 2; ++id) {
+        QJsonObject def;
+        def["id"] = id;
+        def["fg_color"] = qint64(0xff000000u | (id * 0x0f0f0f));
+        def["italic"] = (id % 5 == 0);
+        styleMap->defStyle(def);
+    }
+
+    QVector<OffsetIndex> texts;
+    QVector<QJsonArray> jsonStyles;
+    texts.reserve(kLines);
+    jsonStyles.reserve(kLines);
+    auto runCount = 0;
+    for (auto i = 0; i < kLines; ++i) {
+        auto text = QString("    if (x%1 != nullptr && y%1->z(%1) <= k[%1]) { return w%1; }\n").arg(i);
+        QJsonArray styles;
+        auto offset = 0;
+        for (auto pos = 0; pos + 3 <= text.size(); pos += 3) {
+            styles.append(pos - offset);
+            styles.append(3);
+            styles.append(2 + (pos / 6) % kStyles); // pairs of runs share a style and merge
+            offset = pos + 3;
+        }
+        texts.append(OffsetIndex(text));
+        jsonStyles.append(styles);
+        runCount += styles.size() / 3;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QVector<std::shared_ptr<StyleSpans>> spans;
+    spans.reserve(kLines);
+    auto mergedCount = 0;
+    for (auto i = 0; i < kLines; ++i) {
+        spans.append(StyleSpans::fromJson(jsonStyles[i], texts[i]));
+        mergedCount += spans.last()->size();
+    }
+    auto decodeElapsed = timer.nsecsElapsed() / 1000;
+
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 12));
+    auto selColor = QColor(Qt::blue);
+
+    qint64 applyElapsed = 0;
+    qint64 buildElapsed = 0;
+    qint64 applyAllocations = 0;
+    qint64 buildAllocations = 0;
+    for (auto i = 0; i < kLines; ++i) {
+        auto before = allocations();
+        timer.restart();
+        TextLineBuilder builder(texts[i], font);
+        styleMap->applyStyles(builder, spans[i], selColor);
+        applyElapsed += timer.nsecsElapsed();
+        auto applied = allocations();
+        timer.restart();
+        builder.build();
+        buildElapsed += timer.nsecsElapsed();
+        applyAllocations += applied - before;
+        buildAllocations += allocations() - applied;
+    }
+    applyElapsed /= 1000;
+    buildElapsed /= 1000;
+
+    qDebug() << "style" << kLines << "lines:" << runCount << "runs," << mergedCount << "after merge";
+    qDebug() << "  decode" << decodeElapsed / 1000.0 << "ms, apply" << applyElapsed / 1000.0 << "ms,"
+             << qreal(decodeElapsed + applyElapsed) / kLines << "us/line, build" << buildElapsed / 1000.0 << "ms";
+#if defined(XI_ALLOC_STATS) && defined(__GLIBC__)
+    qDebug() << "  allocations/line: apply" << qreal(applyAllocations) / kLines << "build" << qreal(buildAllocations) / kLines;
+#elif defined(XI_ALLOC_STATS)
+    qDebug() << "  allocations/line (operator new only, Qt container storage excluded): apply"
+             << qreal(applyAllocations) / kLines << "build" << qreal(buildAllocations) / kLines;
+#endif
+}
+
+// code-like lines styled with eight ids, every fourth of them italic; the
+// fixture of the frame benchmarks
+static QVector<std::shared_ptr<TextLine>> styledLines(int count, const std::shared_ptr<Font> &font) {
+    auto styleMap = std::make_shared<StyleMapState>();
+    for (auto id = 2; id < 10; ++id) {
+        QJsonObject def;
+        def["id"] = id;
+        def["fg_color"] = qint64(0xff000000u | (id * 0x1f2f3f));
+        def["italic"] = (id % 4 == 0);
+        styleMap->defStyle(def);
+    }
+    QVector<std::shared_ptr<TextLine>> textLines;
+    textLines.reserve(count);
+    for (auto i = 0; i < count; ++i) {
+        auto text = QString("        let mut value_%1 = compute(&items[%1..], |x| x * %2 + offset); // step %1\n")
+                        .arg(i)
+                        .arg(i % 97);
+        OffsetIndex offsets(text);
+        auto spans = std::make_shared<StyleSpans>();
+        for (auto pos = 8; pos + 4 <= text.size(); pos += 9) {
+            spans->append(pos, 4, 2 + (pos / 9) % 8);
+        }
+        TextLineBuilder builder(offsets, font);
+        builder.setFgColor(Qt::white);
+        styleMap->applyStyles(builder, spans, Qt::blue);
+        textLines.append(builder.build());
+    }
+    return textLines;
+}
+
+// continuous scroll over pre-laid-out styled lines, painted into an offscreen full HD frame
+void Benchmark::scrollFrames() {
+    constexpr auto kLines = 5'000;
+    constexpr auto kFrames = 600;
+    constexpr auto kScrollStep = 7.5;
+    const QSize kViewport(1920, 1080);
+
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 14));
+    auto textLines = styledLines(kLines, font);
+
+    // lines end in a newline like core's, they must still take the monospace path
+    auto monospace = std::count_if(textLines.begin(), textLines.end(), [](const std::shared_ptr<TextLine> &line) {
+        return line->isMonospace();
+    });
+    qDebug() << "scroll: monospace lines" << monospace << "of" << kLines;
+
+    QFontMetricsF metrics(font->getFont());
+    auto linespace = metrics.height();
+    QImage frame(kViewport, QImage::Format_ARGB32_Premultiplied);
+
+    auto atlas = GlyphAtlas::shared();
+    auto tiles = RowTileCache::shared();
+    auto atlasWasEnabled = atlas->isEnabled();
+    auto tilesWereEnabled = tiles->isEnabled();
+    for (auto mode : {"direct", "atlas", "tiles"}) {
+        atlas->setEnabled(qstrcmp(mode, "direct") != 0);
+        tiles->setEnabled(qstrcmp(mode, "tiles") == 0);
+        tiles->clear();
+        atlas->takeStats();
+        QVector<qint64> frameTimes;
+        frameTimes.reserve(kFrames);
+        QElapsedTimer timer;
+        for (auto f = 0; f < kFrames; ++f) {
+            timer.start();
+            QPainter painter(&frame);
+            painter.fillRect(frame.rect(), Qt::black);
+            auto scrollY = f * kScrollStep;
+            auto first = int(scrollY / linespace);
+            auto last = qMin(kLines, int((scrollY + kViewport.height()) / linespace) + 1);
+            for (auto ix = first; ix < last; ++ix) {
+                auto y = linespace * ix - scrollY;
+                if (!tiles->draw(painter, textLines[ix], QPointF(0, y), linespace, Qt::black, 0)) {
+                    Painter::drawLine(painter, textLines[ix], 0, y);
+                }
+            }
+            painter.end();
+            frameTimes.append(timer.nsecsElapsed() / 1000);
+        }
+        std::sort(frameTimes.begin(), frameTimes.end());
+        qint64 total = 0;
+        foreach (qint64 t, frameTimes) {
+            total += t;
+        }
+        auto composited = atlas->takeStats();
+        qDebug() << "scroll" << kFrames << "frames" << kViewport << mode
+                 << "avg" << total / 1000.0 / kFrames << "ms, p95" << frameTimes[kFrames * 95 / 100] / 1000.0 << "ms"
+                 << "atlas runs" << composited.runs << "glyphs" << composited.glyphs << "fallbacks" << composited.fallbacks;
+    }
+    atlas->setEnabled(atlasWasEnabled);
+    tiles->setEnabled(tilesWereEnabled);
+    tiles->clear();
+}
+
+// scrollFrames through the OpenGL backend into an offscreen framebuffer. Runs on
+// a headless box with Mesa's llvmpipe: LIBGL_ALWAYS_SOFTWARE=1 under xvfb-run.
+void Benchmark::openGLFrames() {
+    constexpr auto kLines = 5'000;
+    constexpr auto kFrames = 600;
+    constexpr auto kScrollStep = 7.5;
+    const QSize kViewport(1920, 1080);
+
+    QSurfaceFormat format;
+    if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGL) {
+        format.setVersion(3, 3);
+        format.setProfile(QSurfaceFormat::CoreProfile);
+    } else {
+        format.setVersion(3, 0);
+    }
+    QOpenGLContext context;
+    context.setFormat(format);
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+    if (!context.create() || !context.makeCurrent(&surface)) {
+        qDebug() << "opengl: no context";
+        return;
+    }
+    auto gl = context.functions();
+    qDebug() << "opengl:" << reinterpret_cast<const char *>(gl->glGetString(GL_RENDERER)) << context.format().version();
+
+    GlTextRenderer renderer;
+    if (!renderer.initialize()) {
+        qDebug() << "opengl: renderer unavailable";
+        context.doneCurrent();
+        return;
+    }
+
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 14));
+    auto textLines = styledLines(kLines, font);
+
+    QFontMetricsF metrics(font->getFont());
+    auto linespace = metrics.height();
+    QOpenGLFramebufferObject fbo(kViewport);
+    fbo.bind();
+
+    GlGlyphAtlas atlas;
+    GlFrameBuilder builder(atlas, 1);
+    builder.setDefaultColor(Qt::white);
+    QVector<qint64> frameTimes;
+    frameTimes.reserve(kFrames);
+    qint64 buildNs = 0;
+    qint64 quads = 0;
+    QElapsedTimer timer;
+    for (auto f = 0; f < kFrames; ++f) {
+        timer.start();
+        builder.clear();
+        auto scrollY = f * kScrollStep;
+        auto first = int(scrollY / linespace);
+        auto last = qMin(kLines, int((scrollY + kViewport.height()) / linespace) + 1);
+        for (auto ix = first; ix < last; ++ix) {
+            textLines[ix]->visit(builder, QPointF(0, linespace * ix - scrollY), 0, kViewport.width());
+        }
+        buildNs += timer.nsecsElapsed();
+        quads += builder.quads().size();
+        renderer.render(builder.quads(), Qt::black, kViewport, atlas);
+        gl->glFinish(); // count the rasterization, not just the submission
+        frameTimes.append(timer.nsecsElapsed() / 1000);
+    }
+    std::sort(frameTimes.begin(), frameTimes.end());
+    qint64 total = 0;
+    foreach (qint64 t, frameTimes) {
+        total += t;
+    }
+    qDebug() << "scroll" << kFrames << "frames" << kViewport << "opengl"
+             << "avg" << total / 1000.0 / kFrames << "ms, p95" << frameTimes[kFrames * 95 / 100] / 1000.0 << "ms, quads"
+             << quads / kFrames << "built in" << buildNs / 1000.0 / kFrames << "us";
+
+    fbo.release();
+    renderer.release();
+    context.doneCurrent();
+}
+
+// FrameRenderer::rasterize of a full viewport at dpr 2, one band against as
+// many bands as the frame is tall enough for
+void Benchmark::frameBands() {
+    constexpr auto kLines = 2'000;
+    constexpr auto kFrames = 120;
+    constexpr auto kScrollStep = 7.5;
+    const QSize kViewport(1920, 1080);
+
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 14));
+    auto textLines = styledLines(kLines, font);
+
+    QFontMetricsF metrics(font->getFont());
+    auto linespace = metrics.height();
+    auto frameAt = [&](int f) {
+        ViewportFrame frame;
+        frame.size = kViewport;
+        frame.dpr = 2;
+        frame.linespace = linespace;
+        frame.background = Qt::black;
+        frame.foreground = Qt::white;
+        frame.font = font->getFont();
+        auto scrollY = f * kScrollStep;
+        auto first = int(scrollY / linespace);
+        auto last = qMin(kLines, int((scrollY + kViewport.height()) / linespace) + 1);
+        for (auto ix = first; ix < last; ++ix) {
+            ViewportFrame::Row row;
+            row.pos = QPointF(0, linespace * ix - scrollY);
+            textLines[ix]->visit(row.line, row.pos, 0, kViewport.width());
+            frame.rows.append(row);
+        }
+        return frame;
+    };
+
+    for (auto bands : {1, 0}) {
+        QElapsedTimer timer;
+        timer.start();
+        for (auto f = 0; f < kFrames; ++f) {
+            FrameRenderer::rasterize(frameAt(f), bands);
+        }
+        qDebug() << "rasterize" << kFrames << "frames" << kViewport << "@2x" << (bands ? "1 band" : "auto bands")
+                 << "avg" << timer.nsecsElapsed() / 1e6 / kFrames << "ms";
+    }
+}
+
+// what a painter pays per frame for the theme and style table, N threads
+// reading while one thread keeps applying theme updates, through the lock
+// against through the published snapshot
+void Benchmark::snapshotAcquisition() {
+    constexpr auto kReads = 200'000;
+
+    QJsonObject json;
+    QJsonObject color{{"r", 40}, {"g", 40}, {"b", 40}, {"a", 255}};
+    json["background"] = color;
+    json["foreground"] = color;
+    json["caret"] = color;
+    auto theme = std::make_shared<Theme>();
+    auto styleMap = std::make_shared<StyleMap>();
+    theme->locked()->applyUpdate("bench", json);
+
+    auto readers = qMax(1, QThread::idealThreadCount() - 1);
+    QThreadPool writerPool; // readers take the global pool
+    writerPool.setMaxThreadCount(1);
+    for (auto locked : {true, false}) {
+        std::atomic<bool> done(false);
+        auto writer = QtConcurrent::run(&writerPool, [&]() {
+            while (!done.load()) {
+                theme->locked()->applyUpdate("bench", json);
+                QThread::usleep(100);
+            }
+        });
+        QElapsedTimer timer;
+        timer.start();
+        QVector<int> threads(readers);
+        QtConcurrent::blockingMap(threads, [&](int &sink) {
+            for (auto i = 0; i < kReads; ++i) {
+                if (locked) {
+                    auto state = theme->locked();
+                    sink += state->revision() + state->background().color.alpha();
+                    sink += styleMap->locked()->revision();
+                } else {
+                    auto state = theme->snapshot();
+                    sink += state->revision() + state->background().color.alpha();
+                    sink += styleMap->table()->revision();
+                }
+            }
+        });
+        auto elapsed = timer.nsecsElapsed();
+        done = true;
+        writer.waitForFinished();
+        qDebug() << "theme acquisition" << readers << "readers" << (locked ? "locked" : "snapshot")
+                 << "avg" << qreal(elapsed) / kReads << "ns per frame";
+    }
+}
+
+// the theme reads of one painted line, by name from a hash as themes were
+// stored before, against the ThemeKey indexed colors and brushes
+void Benchmark::themeAccess() {
+    constexpr auto kReads = 1'000'000;
+
+    QJsonObject json;
+    for (auto name : magic_enum::enum_names<ThemeKey>()) {
+        QJsonObject color{{"r", int(name.size())}, {"g", 40}, {"b", 40}, {"a", 255}};
+        json[QLatin1String(name.data(), int(name.size()))] = color;
+    }
+    auto theme = std::make_shared<Theme>();
+    theme->locked()->applyUpdate("bench", json);
+    auto snapshot = theme->snapshot();
+    QHash<QString, ThemeElement> byName;
+    for (auto key : magic_enum::enum_values<ThemeKey>()) {
+        auto name = magic_enum::enum_name(key).value();
+        byName[QString::fromLatin1(name.data(), int(name.size()))] = snapshot->color(key);
+    }
+
+    QImage image(1, 1, QImage::Format_ARGB32_Premultiplied);
+    QPainter painter(&image);
+    qint64 sink = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (auto i = 0; i < kReads; ++i) {
+        painter.fillRect(QRect(0, 0, 1, 1), QColor(byName["background"]));
+        sink += QColor(byName["foreground"]).alpha() + QColor(byName["selection"]).alpha() + QColor(byName["caret"]).alpha();
+    }
+    auto hashed = timer.nsecsElapsed();
+    timer.restart();
+    for (auto i = 0; i < kReads; ++i) {
+        painter.fillRect(QRect(0, 0, 1, 1), snapshot->brush(ThemeKey::background));
+        sink += snapshot->color(ThemeKey::foreground).alpha() + snapshot->color(ThemeKey::selection).alpha() +
+                snapshot->color(ThemeKey::caret).alpha();
+    }
+    auto indexed = timer.nsecsElapsed();
+    qDebug() << "theme access" << kReads << "lines: by name" << qreal(hashed) / kReads << "ns, by key"
+             << qreal(indexed) / kReads << "ns, checksum" << sink;
+}
+
+// a theme switch with 50 tabs open, one viewport of lines each: laying every
+// line out again with the new colors, as when colors were part of the layout,
+// against republishing the style table and drawing through its palette
+void Benchmark::themeSwitch() {
+    constexpr auto kTabs = 50;
+    constexpr auto kVisible = 60;
+    const QSize kViewport(1920, 1080);
+
+    auto styleMap = std::make_shared<StyleMapState>();
+    for (auto id = 2; id < 10; ++id) {
+        QJsonObject def;
+        def["id"] = id;
+        if (id % 2 == 0) def["fg_color"] = qint64(0xff000000u | (id * 0x1f2f3f)); // odd ids take the theme foreground
+        def["italic"] = (id % 4 == 0);
+        styleMap->defStyle(def);
+    }
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 14));
+    QVector<OffsetIndex> texts;
+    QVector<std::shared_ptr<StyleSpans>> spans;
+    QVector<std::shared_ptr<TextLine>> textLines;
+    for (auto i = 0; i < kTabs * kVisible; ++i) {
+        // every fifth line has a tab and goes through QTextLayout
+        auto text = QString("%1let mut value_%2 = compute(&items[%2..], |x| x * %3 + offset);\n")
+                        .arg(i % 5 ? "        " : "\t")
+                        .arg(i)
+                        .arg(i % 97);
+        texts.append(OffsetIndex(text));
+        auto lineSpans = std::make_shared<StyleSpans>();
+        for (auto pos = 8; pos + 4 <= text.size(); pos += 9) {
+            lineSpans->append(pos, 4, 2 + (pos / 9) % 8);
+        }
+        spans.append(lineSpans);
+    }
+    auto buildAll = [&](const QColor &foreground) {
+        textLines.clear();
+        for (auto i = 0; i < texts.size(); ++i) {
+            TextLineBuilder builder(texts[i], font);
+            builder.setFgColor(foreground);
+            styleMap->applyStyles(builder, spans[i], Qt::blue);
+            textLines.append(builder.build());
+        }
+    };
+
+    QFontMetricsF metrics(font->getFont());
+    QImage image(kViewport, QImage::Format_ARGB32_Premultiplied);
+    auto drawTab = [&](const LinePalette *palette) {
+        QPainter painter(&image);
+        painter.fillRect(image.rect(), Qt::black);
+        for (auto ix = 0; ix < kVisible; ++ix) {
+            textLines[ix]->draw(painter, QPointF(0, metrics.height() * ix), palette);
+        }
+    };
+    buildAll(Qt::white);
+    drawTab(nullptr);
+
+    QElapsedTimer timer;
+    timer.start();
+    styleMap->themeChanged();
+    buildAll(Qt::yellow);
+    drawTab(nullptr);
+    auto reshapeNs = timer.nsecsElapsed();
+
+    timer.restart();
+    styleMap->themeChanged();
+    drawTab(styleMap->table()->palette().get());
+    auto recolorNs = timer.nsecsElapsed();
+
+    qDebug() << "theme switch" << kTabs << "tabs," << kVisible << "lines each: re-shaping" << reshapeNs / 1e6
+             << "ms, recoloring" << recolorNs / 1e6 << "ms";
+}
+
+// lines the monospace path rejects, built cold then again from cached tokens
+void Benchmark::tokenShaping() {
+    constexpr auto kLines = 5'000;
+
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 12));
+    QVector<OffsetIndex> texts;
+    texts.reserve(kLines);
+    for (auto i = 0; i < kLines; ++i) {
+        texts.append(OffsetIndex(QString("    let result = 计算(items[%1], limit); // 缓存 hit %2 ✓\n").arg(i % 50).arg(i % 7)));
+    }
+
+    auto cache = ShapingCache::shared();
+    cache->clear();
+    cache->takeStats();
+    for (auto pass : {"cold", "warm"}) {
+        QElapsedTimer timer;
+        timer.start();
+        for (auto i = 0; i < kLines; ++i) {
+            TextLineBuilder builder(texts[i], font);
+            builder.setFgColor(Qt::white);
+            builder.build();
+        }
+        auto elapsed = timer.nsecsElapsed() / 1000;
+        auto stats = cache->takeStats();
+        qDebug() << "shape" << kLines << "lines" << pass << elapsed / 1000.0 << "ms, hit rate"
+                 << qreal(stats.hits) / qMax<qint64>(1, stats.hits + stats.misses) << "shaping"
+                 << stats.shapeNs / 1'000'000.0 << "ms, saved" << stats.savedNs / 1'000'000.0 << "ms";
+    }
+}
+
+// typing on one line with undo, replayed through the line cache; the viewport
+// is laid out after every update the way paint does it
+void Benchmark::editSession() {
+    constexpr auto kLines = 200;
+    constexpr auto kVisible = 60;
+    constexpr auto kEditLine = 30;
+    constexpr auto kKeystrokes = 600;
+    constexpr auto kKeystrokesPerSecond = 15;
+
+    auto styleMap = std::make_shared<StyleMapState>();
+    for (auto id = 2; id < 6; ++id) {
+        QJsonObject def;
+        def["id"] = id;
+        def["fg_color"] = qint64(0xff000000u | (id * 0x203040));
+        styleMap->defStyle(def);
+    }
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 12));
+    auto fontKey = font->getFont().key();
+
+    auto lineText = [](int ix, int edits) {
+        return QString("    fn item_%1(x: u32) -> u32 { x + %1 }").arg(ix) + QString(edits, 'x') + '\n';
+    };
+    auto jsonLine = [](const QString &text, int ln, bool styled) {
+        QJsonObject line;
+        line["text"] = text;
+        line["ln"] = ln;
+        if (styled) line["styles"] = QJsonArray{4, 2, 2, 1, 8, 3, 1, 1, 4, 3, 3, 5};
+        return line;
+    };
+    auto updateOf = [](const QJsonArray &ops) {
+        QJsonObject update;
+        update["ops"] = ops;
+        return update;
+    };
+
+    auto cache = LayoutCache::shared();
+    auto wasEnabled = cache->isEnabled();
+    for (auto enabled : {false, true}) {
+        cache->setEnabled(enabled);
+        cache->clear();
+        cache->takeStats();
+
+        LineCacheState lines;
+        QJsonArray initial;
+        for (auto i = 0; i < kLines; ++i) {
+            initial.append(jsonLine(lineText(i, 0), i + 1, true));
+        }
+        QJsonObject ins;
+        ins["op"] = "ins";
+        ins["n"] = kLines;
+        ins["lines"] = initial;
+
+        qint64 layoutNs = 0;
+        QElapsedTimer timer;
+        auto layoutViewport = [&]() {
+            timer.start();
+            for (auto ix = 0; ix < kVisible; ++ix) {
+                auto line = lines.get(ix);
+                if (!line || line->assoc()) continue;
+                LayoutKey key(line->getText(), line->getStyles(), fontKey, styleMap->table()->shapeRevision());
+                line->setAssoc(cache->layout(key, [&]() {
+                    TextLineBuilder builder(line->offsets(), font);
+                    builder.setFgColor(Qt::white);
+                    styleMap->applyStyles(builder, line->getStyles(), Qt::blue);
+                    return builder.build();
+                }));
+            }
+            layoutNs += timer.nsecsElapsed();
+        };
+
+        lines.applyUpdate(updateOf({ins}));
+        layoutViewport();
+
+        // the edited line cycles through ten states, as typing interleaved with undo does;
+        // core sends it unstyled first, then again once highlighting catches up
+        for (auto k = 1; k <= kKeystrokes; ++k) {
+            auto text = lineText(kEditLine, k % 10);
+            for (auto styled : {false, true}) {
+                QJsonObject before, skip, edited, after;
+                before["op"] = "copy";
+                before["n"] = kEditLine;
+                before["ln"] = 1;
+                skip["op"] = "skip";
+                skip["n"] = 1;
+                edited["op"] = "ins";
+                edited["n"] = 1;
+                edited["lines"] = QJsonArray{jsonLine(text, kEditLine + 1, styled)};
+                after["op"] = "copy";
+                after["n"] = kLines - kEditLine - 1;
+                after["ln"] = kEditLine + 2;
+                lines.applyUpdate(updateOf({before, skip, edited, after}));
+                layoutViewport();
+            }
+        }
+
+        auto stats = cache->takeStats();
+        auto seconds = qreal(kKeystrokes) / kKeystrokesPerSecond;
+        qDebug() << "edit session" << kKeystrokes << "keystrokes" << (enabled ? "layout cache:" : "no cache:")
+                 << stats.built / seconds << "layouts built/s," << stats.hits << "reused,"
+                 << layoutNs / 1'000'000.0 << "ms laying out";
+    }
+    cache->setEnabled(wasEnabled);
+}
+
+// the first highlighting pass: core styles lines with ids it defines one at a
+// time, the viewport is laid out again after every definition
+void Benchmark::styleDefinitions() {
+    constexpr auto kVisible = 60;
+    constexpr auto kStyles = 16;
+
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 12));
+    auto fontKey = font->getFont().key();
+    QVector<QString> texts;
+    QVector<std::shared_ptr<StyleSpans>> styles;
+    for (auto i = 0; i < kVisible; ++i) {
+        auto text = QString("    fn item_%1(x: u32) -> u32 { x * %1 + offset } // step %1\n").arg(i);
+        auto spans = std::make_shared<StyleSpans>();
+        for (auto pos = 4; pos + 4 <= text.size(); pos += 7) {
+            spans->append(pos, 4, 2 + (pos / 7 + i) % kStyles);
+        }
+        texts.append(text);
+        styles.append(spans);
+    }
+
+    auto cache = LayoutCache::shared();
+    cache->clear();
+    cache->takeStats();
+    auto styleMap = std::make_shared<StyleMapState>();
+    auto reshapes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (auto id = 2; id < 2 + kStyles + 1; ++id) {
+        // the last definition is italic and has to reshape
+        if (id > 2) {
+            auto shapeRevision = styleMap->table()->shapeRevision();
+            QJsonObject def;
+            def["id"] = id - 1;
+            def["fg_color"] = qint64(0xff000000u | (id * 0x203040));
+            def["italic"] = (id == 2 + kStyles);
+            styleMap->defStyle(def);
+            reshapes += styleMap->table()->shapeRevision() != shapeRevision;
+        }
+        auto table = styleMap->table();
+        for (auto ix = 0; ix < kVisible; ++ix) {
+            LayoutKey key(texts[ix], styles[ix], fontKey, table->shapeRevision());
+            cache->layout(key, [&]() {
+                TextLineBuilder builder(texts[ix], font);
+                builder.setFgColor(Qt::white);
+                table->applyStyles(builder, styles[ix], Qt::blue);
+                return builder.build();
+            });
+        }
+    }
+    auto stats = cache->takeStats();
+    qDebug() << "style definitions:" << kStyles << "styles defined," << reshapes << "reshaped," << stats.built
+             << "layouts built," << stats.hits << "reused," << timer.nsecsElapsed() / 1'000'000.0 << "ms";
+}
+
+// one 5 MB minified JSON line: build, paint a viewport at the start and at the
+// end, then map the last column to x and back
+void Benchmark::longLine() {
+    constexpr auto kBytes = 5 * 1024 * 1024;
+    const QSize kViewport(1920, 1080);
+
+    QString text;
+    text.reserve(kBytes + 64);
+    text += '[';
+    for (auto i = 0; text.size() < kBytes; ++i) {
+        text += QString("{\"id\":%1,\"name\":\"item_%1\",\"tags\":[\"a\",\"b\"],\"ok\":true},").arg(i);
+    }
+    text += "]\n";
+    OffsetIndex offsets(text);
+
+    auto styleMap = std::make_shared<StyleMapState>();
+    QJsonObject def;
+    def["id"] = 2;
+    def["fg_color"] = qint64(0xffcc7832u);
+    styleMap->defStyle(def);
+    auto spans = std::make_shared<StyleSpans>();
+    for (auto pos = 1; pos + 4 <= text.size(); pos += 40) {
+        spans->append(pos, 4, 2);
+    }
+
+    auto font = std::make_shared<Font>(QFont("Inconsolata", 12));
+    QElapsedTimer timer;
+    timer.start();
+    TextLineBuilder builder(offsets, font);
+    builder.setFgColor(Qt::white);
+    styleMap->applyStyles(builder, spans, Qt::blue);
+    auto textLine = builder.build();
+    auto buildNs = timer.nsecsElapsed();
+
+    QImage frame(kViewport, QImage::Format_ARGB32_Premultiplied);
+    qint64 paintNs[2];
+    for (auto pass = 0; pass < 2; ++pass) {
+        auto scrollX = pass == 0 ? 0 : textLine->width() - kViewport.width();
+        timer.restart();
+        QPainter painter(&frame);
+        painter.setClipRect(frame.rect());
+        Painter::drawLine(painter, textLine, -scrollX, 0);
+        painter.end();
+        paintNs[pass] = timer.nsecsElapsed();
+    }
+
+    timer.restart();
+    auto endX = textLine->indexTox(offsets.utf8Length());
+    auto endIx = textLine->xToIndex(endX);
+    auto mapNs = timer.nsecsElapsed();
+
+    qDebug() << "long line" << text.size() << "units," << (textLine->isChunked() ? "chunked" : "whole")
+             << "build" << buildNs / 1'000'000.0 << "ms, paint start" << paintNs[0] / 1'000'000.0
+             << "ms, paint end" << paintNs[1] / 1'000'000.0 << "ms, map" << mapNs / 1000.0 << "us"
+             << (endIx == offsets.utf8Length() ? "" : "(end column mismatch)");
+}
+
+// soft wrap of 200k lines: initial wrap, one edited line, one inserted line,
+// and row <-> line lookups across the document
+void Benchmark::wrapIndex() {
+    constexpr auto kLines = 200'000;
+    constexpr auto kColumns = 80;
+    constexpr auto kLookups = 100'000;
+
+    CacheLines lines;
+    lines.reserve(kLines);
+    for (auto i = 0; i < kLines; ++i) {
+        auto text = QString("    // comment %1 ").arg(i) + QString("word ").repeated(i % 40) + '\n';
+        lines.append(std::make_shared<Line>(text, std::make_shared<StyleSpans>(), i + 1));
+    }
+
+    WrapIndex index;
+    QElapsedTimer timer;
+    timer.start();
+    index.sync(lines, kColumns);
+    auto initialNs = timer.nsecsElapsed();
+
+    lines[kLines / 2] = std::make_shared<Line>(QString("word ").repeated(100), std::make_shared<StyleSpans>(), kLines / 2 + 1);
+    timer.restart();
+    index.sync(lines, kColumns);
+    auto editNs = timer.nsecsElapsed();
+
+    lines.insert(kLines / 3, std::make_shared<Line>(QString("word ").repeated(60), std::make_shared<StyleSpans>(), kLines / 3 + 1));
+    timer.restart();
+    index.sync(lines, kColumns);
+    auto insertNs = timer.nsecsElapsed();
+
+    auto rows = index.rows();
+    auto mismatches = 0;
+    timer.restart();
+    for (auto i = 0; i < kLookups; ++i) {
+        auto row = int(qint64(i) * rows / kLookups);
+        auto line = index.lineAt(row);
+        if (row < index.rowOf(line) || row >= index.rowOf(line) + index.rowCount(line)) ++mismatches;
+    }
+    auto lookupNs = timer.nsecsElapsed();
+
+    qDebug() << "wrap" << lines.size() << "lines to" << rows << "rows: initial" << initialNs / 1'000'000.0
+             << "ms, edit" << editNs / 1000.0 << "us, insert" << insertNs / 1000.0 << "us, lookup"
+             << qreal(lookupNs) / kLookups << "ns" << (mismatches ? "(row mismatches)" : "");
+}
+
+// event loop wakeups of the whole process while nobody touches it, open views included
+void Benchmark::idleWakeups() {
+    constexpr auto kIdleMs = 2000;
+
+    qint64 wakeups = 0;
+    auto connection = QObject::connect(QAbstractEventDispatcher::instance(), &QAbstractEventDispatcher::awake, [&]() {
+        ++wakeups;
+    });
+    QEventLoop loop;
+    QTimer::singleShot(kIdleMs, &loop, &QEventLoop::quit);
+    loop.exec();
+    QObject::disconnect(connection);
+
+    wakeups = qMax<qint64>(0, wakeups - 1); // the quit timer
+    qDebug() << "idle:" << wakeups * 1000.0 / kIdleMs << "wakeups/s";
+}
+
+// an idle window whose only activity is a blinking caret: process CPU time,
+// wakeups and the area each blink repaints
+void Benchmark::caretBlink() {
+    constexpr auto kIdleMs = 3000;
+
+    QWidget host;
+    host.resize(800, 600);
+    auto overlay = new CaretOverlay(&host);
+    overlay->setGeometry(host.rect());
+    host.show();
+    overlay->setCarets({QPoint(120, 200)}, 18, Qt::black);
+    overlay->setBlinking(true); // as if focused
+    if (!overlay->isBlinking()) {
+        qDebug() << "caret blink: disabled by the platform";
+        return;
+    }
+    overlay->takeStats();
+
+    qint64 wakeups = 0;
+    auto connection = QObject::connect(QAbstractEventDispatcher::instance(), &QAbstractEventDispatcher::awake, [&]() {
+        ++wakeups;
+    });
+    auto cpu = std::clock();
+    QEventLoop loop;
+    QTimer::singleShot(kIdleMs, &loop, &QEventLoop::quit);
+    loop.exec();
+    auto cpuMs = (std::clock() - cpu) * 1000.0 / CLOCKS_PER_SEC;
+    QObject::disconnect(connection);
+
+    auto stats = overlay->takeStats();
+    qDebug() << "caret blink:" << stats.blinks * 1000.0 / kIdleMs << "blinks/s"
+             << wakeups * 1000.0 / kIdleMs << "wakeups/s"
+             << "cpu" << cpuMs * 100 / kIdleMs << "%"
+             << "pixels/paint" << (stats.paints ? stats.paintedPixels / stats.paints : 0);
+}
+
+} // namespace xi
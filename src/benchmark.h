@@ -0,0 +1,37 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QString>
+
+namespace xi {
+
+// In-process benchmarks, results go to the debug output
+class Benchmark {
+public:
+    static Benchmark *shared();
+
+    void run();
+
+private:
+    Benchmark() {}
+
+    void decodeInsert();
+    void styleApplication();
+    void scrollFrames();
+    void openGLFrames();
+    void frameBands();
+    void snapshotAcquisition();
+    void themeAccess();
+    void themeSwitch();
+    void tokenShaping();
+    void editSession();
+    void styleDefinitions();
+    void longLine();
+    void wrapIndex();
+    void idleWakeups();
+    void caretBlink();
+};
+
+} // namespace xi
+
+#endif // BENCHMARK_H
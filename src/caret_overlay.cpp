@@ -0,0 +1,116 @@
+#include "caret_overlay.h"
+
+#include <QApplication>
+#include <QEvent>
+#include <QPaintEvent>
+#include <QPainter>
+
+#include "frame_scheduler.h"
+#include "text_line.h"
+
+namespace xi {
+
+CaretOverlay::CaretOverlay(QWidget *parent) : QWidget(parent) {
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+    setAttribute(Qt::WA_InputMethodTransparent);
+    setAttribute(Qt::WA_NoSystemBackground);
+    setFocusPolicy(Qt::NoFocus);
+
+    // a flash time of 0 disables blinking
+    auto interval = QApplication::cursorFlashTime() / 2;
+    m_blink.setInterval(qMax(interval, 0));
+    connect(&m_blink, &QTimer::timeout, this, &CaretOverlay::blink);
+    parent->installEventFilter(this);
+    syncBlinking();
+}
+
+void CaretOverlay::setCarets(const QVector<QPoint> &carets, int height, const QColor &color, const QRect &exposed) {
+    QVector<QRect> rects;
+    rects.reserve(carets.size());
+    for (const QPoint &pos : carets) {
+        rects.append(QRect(pos.x(), pos.y(), kCaretWidth, height));
+    }
+    if (rects == m_carets && color == m_color) return;
+
+    // drawn old positions are erased, new ones drawn, shared ones untouched unless hidden
+    QVector<QRect> dirty;
+    for (const QRect &rect : m_carets) {
+        if (m_shown && (color != m_color || !rects.contains(rect))) dirty.append(rect);
+    }
+    for (const QRect &rect : rects) {
+        if (color != m_color || !m_shown || !m_carets.contains(rect)) dirty.append(rect);
+    }
+    m_carets = std::move(rects);
+    m_color = color;
+    m_shown = true;
+    // a moved caret stays visible for a full interval
+    if (m_blink.isActive()) m_blink.start();
+    invalidate(dirty, exposed);
+    syncBlinking();
+}
+
+void CaretOverlay::setBlinking(bool enabled) {
+    if (enabled == isBlinking()) return;
+    if (enabled && m_blink.interval() > 0) {
+        m_blink.start();
+        return;
+    }
+    m_blink.stop();
+    if (!m_shown) {
+        m_shown = true;
+        invalidate(m_carets);
+    }
+}
+
+CaretOverlay::Stats CaretOverlay::takeStats() {
+    auto stats = m_stats;
+    m_stats = Stats();
+    return stats;
+}
+
+void CaretOverlay::paintEvent(QPaintEvent *event) {
+    ++m_stats.paints;
+    for (const QRect &rect : event->region()) {
+        m_stats.paintedPixels += qint64(rect.width()) * rect.height();
+    }
+    if (!m_shown) return;
+    QPainter painter(this);
+    for (const QRect &rect : m_carets) {
+        if (!event->region().intersects(rect)) continue;
+        Painter::drawCursor(painter, rect.x(), rect.y(), rect.width(), rect.height(), m_color);
+    }
+}
+
+void CaretOverlay::changeEvent(QEvent *event) {
+    if (event->type() == QEvent::ActivationChange) {
+        syncBlinking();
+    }
+    QWidget::changeEvent(event);
+}
+
+bool CaretOverlay::eventFilter(QObject *watched, QEvent *event) {
+    if (watched == parentWidget() && (event->type() == QEvent::FocusIn || event->type() == QEvent::FocusOut)) {
+        syncBlinking();
+    }
+    return QWidget::eventFilter(watched, event);
+}
+
+void CaretOverlay::blink() {
+    ++m_stats.blinks;
+    m_shown = !m_shown;
+    invalidate(m_carets);
+}
+
+void CaretOverlay::syncBlinking() {
+    // no carets, no timer
+    setBlinking(!m_carets.isEmpty() && isActiveWindow() && parentWidget()->hasFocus());
+}
+
+void CaretOverlay::invalidate(const QVector<QRect> &rects, const QRect &exposed) {
+    auto scheduler = FrameScheduler::of(this);
+    for (const QRect &rect : rects) {
+        if (!exposed.contains(rect)) scheduler->invalidate(this, rect);
+    }
+}
+
+} // namespace xi
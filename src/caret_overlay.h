@@ -0,0 +1,66 @@
+#ifndef CARET_OVERLAY_H
+#define CARET_OVERLAY_H
+
+#include <QColor>
+#include <QPoint>
+#include <QRect>
+#include <QTimer>
+#include <QVector>
+#include <QWidget>
+
+namespace xi {
+
+// Carets of the parent view, painted in a transparent child above its text.
+// A caret move or a blink repaints only the caret rectangles, the text under
+// them comes from the parent's tiles. Blinks while the parent has focus in the
+// active window, otherwise the carets stay solid and nothing wakes up.
+class CaretOverlay : public QWidget {
+    Q_OBJECT
+public:
+    static constexpr int kCaretWidth = 2;
+
+    struct Stats {
+        qint64 blinks = 0;
+        qint64 paints = 0;
+        qint64 paintedPixels = 0; // logical pixels of the painted regions
+    };
+
+    explicit CaretOverlay(QWidget *parent);
+
+    // top left corners in parent coordinates. Carets inside exposed are
+    // painted by the repaint already in progress and are not invalidated.
+    void setCarets(const QVector<QPoint> &carets, int height, const QColor &color, const QRect &exposed = QRect());
+
+    inline const QVector<QRect> &carets() const {
+        return m_carets;
+    }
+
+    // focus tracking and caret changes turn it on and off, benchmarks force it
+    void setBlinking(bool enabled);
+    inline bool isBlinking() const {
+        return m_blink.isActive();
+    }
+
+    // counters since the last call
+    Stats takeStats();
+
+protected:
+    virtual void paintEvent(QPaintEvent *event) override;
+    virtual void changeEvent(QEvent *event) override;
+    virtual bool eventFilter(QObject *watched, QEvent *event) override;
+
+private:
+    void blink();
+    void syncBlinking();
+    void invalidate(const QVector<QRect> &rects, const QRect &exposed = QRect());
+
+    QVector<QRect> m_carets;
+    QColor m_color;
+    bool m_shown = true; // blink phase
+    QTimer m_blink;
+    Stats m_stats;
+};
+
+} // namespace xi
+
+#endif // CARET_OVERLAY_H
@@ -39,11 +39,18 @@ QVariant to_variant(const QJsonValue &json) {
 }
 
 void ConfigState::applyUpdate(const QJsonObject &json) {
+    auto snapshot = std::make_shared<ConfigSnapshot>();
     for (auto i = 0; i < std::size(names); ++i) {
         const QString name = names[i];
-        auto &element = m_elements[name];
-        element = to_variant(json[name]);
+        snapshot->m_elements[name] = to_variant(json[name]);
     }
+    std::atomic_store(&m_snapshot, std::shared_ptr<const ConfigSnapshot>(snapshot));
+}
+
+void ConfigState::setElement(const QString &name, const QVariant &variant) {
+    auto snapshot = std::make_shared<ConfigSnapshot>(*m_snapshot);
+    snapshot->m_elements[name] = variant;
+    std::atomic_store(&m_snapshot, std::shared_ptr<const ConfigSnapshot>(snapshot));
 }
 
 } // namespace xi
\ No newline at end of file
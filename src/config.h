@@ -1,6 +1,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <QHash>
 #include <QString>
 #include <QStringList>
 #include <QVariant>
@@ -11,23 +12,55 @@
 
 namespace xi {
 
-#define CONFIG_STATE_METHOD(TypeName)                                           \
-    void TypeName(const QVariant &variant) { m_elements[#TypeName] = variant; } \
-    QVariant TypeName() { return m_elements[#TypeName]; }
+#define CONFIG_SNAPSHOT_METHOD(TypeName) \
+    QVariant TypeName() const { return m_elements.value(#TypeName); }
+
+#define CONFIG_STATE_METHOD(TypeName)                                          \
+    void TypeName(const QVariant &variant) { setElement(#TypeName, variant); } \
+    QVariant TypeName() { return m_snapshot->TypeName(); }
 
 #define CONFIG_LOCKED_METHOD(TypeName)                                     \
     void TypeName(const QVariant &variant) { m_inner->TypeName(variant); } \
     QVariant TypeName() { return m_inner->TypeName(); }
 
-class ConfigState : public UnfairLock {
+// One version of the config, never changed once published
+class ConfigSnapshot {
+    friend class ConfigState;
+
 public:
     using Elements = QHash<QString, QVariant>;
 
+    CONFIG_SNAPSHOT_METHOD(auto_indent);
+    CONFIG_SNAPSHOT_METHOD(font_face);
+    CONFIG_SNAPSHOT_METHOD(font_size);
+    CONFIG_SNAPSHOT_METHOD(line_ending);
+    CONFIG_SNAPSHOT_METHOD(plugin_search_path);
+    CONFIG_SNAPSHOT_METHOD(scroll_past_end);
+    CONFIG_SNAPSHOT_METHOD(tab_size);
+    CONFIG_SNAPSHOT_METHOD(translate_tabs_to_spaces);
+    CONFIG_SNAPSHOT_METHOD(use_tab_stops);
+    CONFIG_SNAPSHOT_METHOD(word_wrap);
+    CONFIG_SNAPSHOT_METHOD(wrap_width);
+
+private:
+    Elements m_elements;
+};
+
+class ConfigState : public UnfairLock {
+public:
+    using Elements = ConfigSnapshot::Elements;
+
     ConfigState() {
+        m_snapshot = std::make_shared<ConfigSnapshot>();
     }
 
     void applyUpdate(const QJsonObject &json);
 
+    // the only member readers may call without the lock
+    inline std::shared_ptr<const ConfigSnapshot> snapshot() const {
+        return std::atomic_load(&m_snapshot);
+    }
+
     CONFIG_STATE_METHOD(auto_indent);
     CONFIG_STATE_METHOD(font_face);
     CONFIG_STATE_METHOD(font_size);
@@ -41,7 +74,9 @@ public:
     CONFIG_STATE_METHOD(wrap_width);
 
 private:
-    Elements m_elements;
+    void setElement(const QString &name, const QVariant &variant);
+
+    std::shared_ptr<const ConfigSnapshot> m_snapshot; // swapped atomically, written under the lock
 };
 
 class ConfigLocked {
@@ -84,6 +119,11 @@ public:
         return std::make_shared<ConfigLocked>(m_state);
     }
 
+    // takes no lock
+    std::shared_ptr<const ConfigSnapshot> snapshot() const {
+        return m_state->snapshot();
+    }
+
 private:
     std::shared_ptr<ConfigState> m_state;
 };
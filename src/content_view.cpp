@@ -3,18 +3,30 @@
 #include <QApplication>
 #include <QClipboard>
 #include <QMimeData>
+#include <QOpenGLContext>
+#include <QSet>
 #include <QThreadPool>
 #include <QtConcurrent>
 
+#include <algorithm>
+
 #include "config.h"
 #include "edit_view.h"
+#include "glyph_cache.h"
+#include "layout_cache.h"
 #include "perference.h"
+#include "row_tile_cache.h"
+#include "shaping_cache.h"
 #include "theme.h"
+#include "trace.h"
 
 namespace xi {
 
 static constexpr const char *CONTENT_FONT = "Inconsolata";
 
+// viewports requested from core, and laid out ahead, on each side of the visible one
+static constexpr auto kMaxPrefetch = 1;
+
 ContentView::ContentView(
     std::shared_ptr<File> file,
     std::shared_ptr<CoreConnection> connection,
@@ -37,6 +49,9 @@ ContentView::ContentView(
 
     m_dataSource = std::make_shared<DataSource>();
 
+    // below the IME composition
+    m_caretOverlay = new CaretOverlay(this);
+
     m_imeComposition = std::make_unique<QLabel>(this);
     m_imeComposition->setVisible(false);
     m_imeComposition->setTextFormat(Qt::PlainText);
@@ -49,7 +64,30 @@ ContentView::ContentView(
     m_padding.setRight(0);
     m_padding.setBottom(0);
 
-    m_asyncPaintTimer = std::make_unique<AsyncPaintTimer>(this);
+    m_prefetcher = std::make_unique<LayoutPrefetcher>(m_dataSource->lines);
+
+    m_openTimer.start();
+    m_statsTimer.start();
+    if (!m_file->path().isEmpty()) {
+        // shown only if it lands before core's first lines, any update counts
+        connect(&m_snapshotLoader, &QFutureWatcher<std::shared_ptr<ViewSnapshot>>::finished, this, [this]() {
+            auto snapshot = m_snapshotLoader.result();
+            if (!snapshot || m_dataSource->lines->locked()->revision() != m_snapshotLineRevision) return;
+            m_snapshot = snapshot;
+            m_scrollOrigin = m_snapshot->scrollOrigin();
+            m_firstLine = m_snapshot->firstLine();
+            // resizeEvent asked core for the top of the file, ask for the snapshot's lines instead
+            if (m_visibleLines > 0) {
+                m_connection->sendScroll(m_file->viewId(), m_firstLine, m_firstLine + m_visibleLines);
+            }
+            asyncPaint();
+        });
+        m_snapshotLineRevision = m_dataSource->lines->locked()->revision();
+        auto path = m_file->path();
+        m_snapshotLoader.setFuture(QtConcurrent::run(QThreadPool::globalInstance(), [path]() {
+            return ViewSnapshot::load(path);
+        }));
+    }
 
     connect(this, &ContentView::repaintContentReceived, this, &ContentView::repaintContentHandler);
 
@@ -68,10 +106,37 @@ bool ContentView::event(QEvent *e) {
 }
 
 void ContentView::paintEvent(QPaintEvent *event) {
+    if (m_gl) return; // covered, ContentViewOpenGL paints
+    if (m_frameRenderer) {
+        QElapsedTimer timer;
+        timer.start();
+        QPainter painter(this);
+        auto dirtyRect = event->rect();
+        auto dpr = m_frameImage.devicePixelRatio();
+        if (m_frameImage.isNull() || m_frameImage.size() != size() * dpr) {
+            painter.fillRect(dirtyRect, Perference::shared()->theme()->snapshot()->brush(ThemeKey::background));
+            asyncPaint();
+        }
+        if (!m_frameImage.isNull()) {
+            painter.drawImage(dirtyRect, m_frameImage, QRectF(QPointF(dirtyRect.topLeft()) * dpr, QSizeF(dirtyRect.size()) * dpr));
+        }
+        painter.end();
+        tick(timer.nsecsElapsed());
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    if (!m_pendingScroll.isNull()) {
+        // painted before the blit, the pixels it would have moved are stale
+        m_pendingScroll = QPoint();
+        m_cursorCache.clear();
+        asyncPaint();
+    }
     QPainter painter(this);
     auto dirtyRect = event->rect();
     paint(painter, dirtyRect);
-    tick();
+    painter.end();
+    tick(timer.nsecsElapsed());
 }
 
 void ContentView::resizeEvent(QResizeEvent *event) {
@@ -83,6 +148,16 @@ void ContentView::resizeEvent(QResizeEvent *event) {
         m_visibleLines = visibleLines;
         m_connection->sendScroll(m_file->viewId(), m_firstLine, m_firstLine + m_visibleLines);
     }
+    if (size.width() != event->oldSize().width()) {
+        syncWrap();
+    }
+    if (m_gl) {
+        m_gl->setGeometry(QRect(QPoint(), size));
+    }
+    m_caretOverlay->setGeometry(QRect(QPoint(), size));
+    if (m_frameRenderer) {
+        asyncPaint();
+    }
     QWidget::resizeEvent(event);
 }
 
@@ -97,44 +172,88 @@ ClosedRangeI ContentView::getVisibleLinesRange(const QRect &bound) {
     auto linespace = getLinespace();
     auto firstVisible = qMax(0, (int)(std::ceil((bound.y() - m_padding.top() + m_scrollOrigin.y()) / linespace)));
     auto lastVisible = qMax(0, (int)(std::ceil((bound.y() + bound.height() - m_padding.top() + m_scrollOrigin.y()) / linespace)));
-    return ClosedRangeI(firstVisible, lastVisible);
+    return ClosedRangeI(lineOfRow(firstVisible), lineOfRow(lastVisible));
 }
 
 void ContentView::paint(QPainter &renderer, const QRect &dirtyRect) {
     auto lineCache = m_dataSource->lines->locked();
     auto linespace = m_dataSource->fontMetrics->height();
     m_padding.setTop(linespace - m_dataSource->fontMetrics->ascent());
-    auto xOff = m_dataSource->gutterWidth + m_padding.left() - m_scrollOrigin.x();
-    auto yOff = m_padding.top() - m_scrollOrigin.y();
 
-    auto firstVisible = qMax(0, (int)(std::ceil((dirtyRect.y() - m_padding.top() + m_scrollOrigin.y()) / linespace)));
-    auto lastVisible = qMax(0, (int)(std::ceil((dirtyRect.y() + dirtyRect.height() - m_padding.top() + m_scrollOrigin.y()) / linespace)));
+    if (lineCache->isEmpty() && m_snapshot) {
+        paintLines(renderer, dirtyRect, m_snapshot->firstLine(), m_snapshot->lines(), m_snapshot->totalLines(), m_snapshot->styleMap()->table());
+        reportFirstPaint(true);
+        return;
+    }
 
     auto totalLines = lineCache->height();
-
-    auto first = qMin(totalLines, firstVisible);
-    auto last = qMin(totalLines, lastVisible);
-
-    auto fetchRange = RangeI(first, last);
+    auto fetchRange = linesInRect(dirtyRect, totalLines);
+    auto first = fetchRange.start();
     auto lines = lineCache->blockingGet(fetchRange);
 
     if (lineCache->isMissingLines(lines, fetchRange)) {
         return;
     }
 
-	m_dataSource->gutterWidth = m_dataSource->gutterOne * QString::number(totalLines).count() + 30;
+    if (dirtyRect.top() <= 0) {
+        m_firstLine = first; // not from a strip exposed by scrolling
+    }
 
-    auto font = m_dataSource->defaultFont;
-    auto theme = Perference::shared()->theme()->locked();
-    auto styleMap = Perference::shared()->styleMap()->locked();
+    auto styles = Perference::shared()->styleMap()->table();
+    if (styles->shapeRevision() != m_shapeRevision) {
+        m_shapeRevision = styles->shapeRevision();
+        lineCache->flushAssoc(); // a definition changed more than colors
+    }
+    paintLines(renderer, dirtyRect, first, lines, totalLines, styles);
+
+    // real widths of lines laid out since the last paint replace their column estimates
+    auto advance = getAverageCharWidth();
+    for (auto relLineIx = 0; relLineIx < lines.size(); ++relLineIx) {
+        const auto &line = lines[relLineIx];
+        if (line && line->assoc() && !line->isWidthRefined()) {
+            lineCache->refineWidth(first + relLineIx, line->assoc()->width() / advance);
+        }
+    }
+    if (!lineCache->isEmpty()) {
+        reportFirstPaint(false);
+    }
+}
+
+void ContentView::paintLines(QPainter &renderer, const QRect &dirtyRect, int first, const CacheLines &lines, int totalLines, const std::shared_ptr<const StyleTable> &styles) {
+    auto linespace = m_dataSource->fontMetrics->height();
+    auto xOff = m_dataSource->gutterWidth + m_padding.left() - m_scrollOrigin.x();
+    auto yOff = m_padding.top() - m_scrollOrigin.y();
+    auto last = first + lines.size();
+
+    auto gutterWidth = m_dataSource->gutterOne * QString::number(totalLines).count() + 30;
+    if (gutterWidth != m_dataSource->gutterWidth) {
+        m_dataSource->gutterWidth = gutterWidth;
+        asyncPaint(); // content moved sideways, pixels kept by scrolling are stale
+    }
+
+    auto fontKey = m_dataSource->defaultFont->getFont().key();
+    auto theme = Perference::shared()->theme()->snapshot();
+    auto palette = styles->palette().get();
 
     QList<std::shared_ptr<TextLine>> textLines;
 
-    m_firstLine = first;
     qreal maxLineWidth = 0;
 
+    // whatever part of the gutter is handed to us gets painted, invalidateContent
+    // leaves it out of full repaints that wouldn't change it
+    QRect gutterRect(0, dirtyRect.y(), gutterWidth, dirtyRect.height());
+    QRect textRect = dirtyRect & QRect(gutterWidth, 0, width() - gutterWidth, height());
+    auto paintGutterNeeded = dirtyRect.left() < gutterWidth;
+    if (paintGutterNeeded && dirtyRect.top() <= 0 && dirtyRect.bottom() >= height() - 1) {
+        m_gutterState = gutterState(gutterWidth, first, lines, theme->revision());
+    } else if (paintGutterNeeded) {
+        m_gutterState = GutterState(); // only a strip is current
+    }
+
     // background
-    renderer.fillRect(dirtyRect, theme->background());
+    renderer.fillRect(textRect, theme->brush(ThemeKey::background));
+    renderer.save();
+    renderer.setClipRect(textRect);
 
     // first pass: create TextLine objects and also draw background rects
     for (auto lineIx = first; lineIx < last; ++lineIx) {
@@ -144,78 +263,387 @@ void ContentView::paint(QPainter &renderer, const QRect &dirtyRect) {
             textLines.append(nullptr);
             continue;
         }
-        auto textLine = line->assoc();
-        if (textLine) {
-            textLines.append(textLine);
-        } else {
-            auto builder = std::make_shared<TextLineBuilder>(line->getText(), font);
-            builder->setFgColor(theme->foreground());
-            styleMap->applyStyles(builder, line->getStyles(), theme->selection(), theme->highlight());
-            textLine = builder->build();
-            textLines.append(textLine);
-            line->setAssoc(textLine);
-            //auto y0 = yOff + linespace * lineIx;
-            //RangeF yRange(y0, y0 + linespace);
-            //Painter::drawLineBg(renderer, textLine, xOff, yRange);
-        }
+        auto textLine = layoutLine(line, styles, fontKey, theme->color(ThemeKey::foreground), theme->color(ThemeKey::selection));
+        textLines.append(textLine);
         maxLineWidth = qMax(maxLineWidth, textLine->width());
     }
 
-    m_maxLineWidth = maxLineWidth;
+    m_maxLineWidth = m_wordWrap ? 0 : maxLineWidth; // wrapped rows never scroll sideways
+
+    // decorations of all rows first, so each color is painted in one call
+    DecorationBatch decorations;
+    QVector<bool> highlighted(lines.size(), false);
+    for (auto lineIx = first; lineIx < last; ++lineIx) {
+        auto relLineIx = lineIx - first;
+        auto textLine = textLines[relLineIx];
+        if (!textLine) continue;
+        auto y = yOff + m_dataSource->fontMetrics->ascent() - linespace + linespace * getRow(lineIx);
+        highlighted[relLineIx] = collectDecorations(decorations, lineIx, lines[relLineIx], textLine, *styles, xOff, y, theme->color(ThemeKey::foreground), theme->color(ThemeKey::highlight));
+    }
+    decorations.drawBehindText(renderer);
+
+    if (Trace::shared()->isEnabled() && m_statsTimer.elapsed() >= 1000) {
+        auto seconds = m_statsTimer.restart() / 1000.0;
+        auto layouts = LayoutCache::shared()->takeStats();
+        auto shaping = ShapingCache::shared()->takeStats();
+        qDebug() << "layouts/s: built" << layouts.built / seconds << "reused" << layouts.hits / seconds;
+        auto frames = scheduler()->takeStats();
+        if (frames.elapsedMs > 0) {
+            auto frameSeconds = frames.elapsedMs / 1000.0;
+            qDebug() << "frames/s" << frames.frames / frameSeconds << "wakeups/s" << frames.wakeups / frameSeconds;
+        }
+        if (shaping.hits + shaping.misses > 0) {
+            qDebug() << "shaping: hit rate" << qreal(shaping.hits) / (shaping.hits + shaping.misses)
+                     << "shaped" << shaping.shapeNs / 1000 << "us, saved" << shaping.savedNs / 1000 << "us";
+        }
+    }
 
     // second pass: draw text & sel background
     for (auto lineIx = first; lineIx < last; ++lineIx) {
         auto textLine = textLines[lineIx - first];
         if (textLine) {
-            auto y = yOff + m_dataSource->fontMetrics->ascent() - linespace + linespace * lineIx;
-            Painter::drawLine(renderer, textLine, xOff, y);
+            auto y = yOff + m_dataSource->fontMetrics->ascent() - linespace + linespace * getRow(lineIx);
+            auto rows = rowsOfLine(lineIx);
+            if (rows == 1) {
+                // tiles are opaque and would hide the highlights behind the text
+                if (highlighted[lineIx - first] || !RowTileCache::shared()->draw(renderer, textLine, QPointF(xOff, y), linespace, theme->color(ThemeKey::background), theme->revision(), palette)) {
+                    Painter::drawLine(renderer, textLine, xOff, y, palette);
+                }
+                continue;
+            }
+            // wrapped: the whole line once per row, shifted to the row's start and clipped to it
+            for (auto subRow = 0; subRow < rows; ++subRow) {
+                auto rowY = y + linespace * subRow;
+                renderer.save();
+                renderer.setClipRect(QRectF(0, rowY, width(), linespace), Qt::IntersectClip);
+                Painter::drawLine(renderer, textLine, xOff - wrapX(lineIx, lines[lineIx - first], textLine, subRow), rowY, palette);
+                renderer.restore();
+            }
         }
     }
 
     // third pass: draw text decorations
-    //for (auto lineIx = first; lineIx < last; ++lineIx) {
-    //	auto textLine = textLines[lineIx - first];
-    //	if (textLine) {
-    //		auto y = yOff + m_dataSource->fontMetrics->ascent() + linespace + lineIx;
-    //		Renderer::drawLineDecorations(renderer, textLine, xOff, y);
-    //	}
-    //}
-
-	m_cursorCache.clear();
-    // fourth pass: draw carets
+    decorations.drawOverText(renderer);
+
+    // carets outside the dirty rect keep their positions, shifted by blitScroll
+    m_cursorCache.erase(std::remove_if(m_cursorCache.begin(), m_cursorCache.end(), [&](const QPoint &pos) {
+                            return pos.y() + linespace > dirtyRect.top() && pos.y() <= dirtyRect.bottom();
+                        }),
+                        m_cursorCache.end());
+    // fourth pass: place carets, the overlay draws them after this paint
     for (auto lineIx = first; lineIx < last; ++lineIx) {
         auto relLineIx = lineIx - first;
         auto textLine = textLines[relLineIx];
         auto line = lines[relLineIx];
         if (textLine && line) {
-            auto y0 = yOff + m_dataSource->fontMetrics->ascent() - linespace + linespace * lineIx;
+            auto y0 = yOff + m_dataSource->fontMetrics->ascent() - linespace + linespace * getRow(lineIx);
             auto cursors = line->getCursor();
             foreach (int cursor, *cursors) {
-                auto x0 = xOff + textLine->indexTox(cursor) - 0.5f;
-                Painter::drawCursor(renderer, x0, y0, 2, linespace, theme->caret());
-                m_cursorCache.push_back(QPoint(x0, y0));
+                auto subRow = m_wordWrap ? m_wrap.subRowOf(lineIx, line->offsets().utf8ToUtf16(cursor)) : 0;
+                auto x0 = xOff + textLine->indexTox(cursor) - wrapX(lineIx, line, textLine, subRow) - 0.5f;
+                auto y = y0 + linespace * subRow;
+                m_cursorCache.push_back(QPoint(x0, y));
 			}
         }
     }
+    m_caretOverlay->setCarets(m_cursorCache, linespace, theme->color(ThemeKey::caret), dirtyRect);
 
-    // gutter drawing
-    QRect gutterRect = {
-        0,
-        0,
-        m_dataSource->gutterWidth,
-        dirtyRect.height()};
-    renderer.fillRect(gutterRect, theme->gutter());
-    for (auto lineIx = first; lineIx < last; ++lineIx) {
-        auto relLineIx = lineIx - first;
+    renderer.restore();
+
+    if (paintGutterNeeded) {
+        paintGutter(renderer, gutterRect, first, lines, theme->color(ThemeKey::gutter), theme->color(ThemeKey::foreground)); // theme->gutter_foreground()
+    }
+}
+
+// the line's TextLine, from its assoc, the shared LayoutCache or built now
+std::shared_ptr<TextLine> ContentView::layoutLine(const std::shared_ptr<Line> &line, const std::shared_ptr<const StyleTable> &styles, const QString &fontKey,
+                                                  const QColor &foreground, const QColor &selection) {
+    auto textLine = line->assoc();
+    if (textLine) return textLine;
+    LayoutKey key(line->getText(), line->getStyles(), fontKey, styles->shapeRevision());
+    textLine = LayoutCache::shared()->layout(key, [&]() {
+        TextLineBuilder builder(line->offsets(), m_dataSource->defaultFont);
+        builder.setFgColor(foreground);
+        styles->applyStyles(builder, line->getStyles(), selection);
+        return builder.build();
+    });
+    line->setAssoc(textLine);
+    return textLine;
+}
+
+std::shared_ptr<ViewportFrame> ContentView::describeFrame() {
+    auto frame = std::make_shared<ViewportFrame>();
+    auto lineCache = m_dataSource->lines->locked();
+    auto metrics = m_dataSource->fontMetrics;
+    auto linespace = metrics->height();
+    m_padding.setTop(linespace - metrics->ascent());
+
+    auto fromSnapshot = lineCache->isEmpty() && m_snapshot;
+    auto first = 0;
+    auto totalLines = 0;
+    CacheLines lines;
+    std::shared_ptr<const StyleTable> styles;
+    if (fromSnapshot) {
+        first = m_snapshot->firstLine();
+        lines = m_snapshot->lines();
+        totalLines = m_snapshot->totalLines();
+        styles = m_snapshot->styleMap()->table();
+    } else {
+        auto firstVisible = qMax(0, (int)(std::ceil((-m_padding.top() + m_scrollOrigin.y()) / linespace)));
+        auto lastVisible = qMax(0, (int)(std::ceil((height() - m_padding.top() + m_scrollOrigin.y()) / linespace)));
+        totalLines = lineCache->height();
+        first = qMin(totalLines, lineOfRow(firstVisible));
+        auto last = qMin(totalLines, lastVisible > firstVisible ? lineOfRow(lastVisible - 1) + 1 : first);
+        lines = lineCache->blockingGet(RangeI(first, last)); // missing lines stay blank this frame
+        m_firstLine = first;
+        styles = Perference::shared()->styleMap()->table();
+        if (styles->shapeRevision() != m_shapeRevision) {
+            m_shapeRevision = styles->shapeRevision();
+            lineCache->flushAssoc();
+        }
+    }
+
+    auto gutterWidth = m_dataSource->gutterOne * QString::number(totalLines).count() + 30;
+    m_dataSource->gutterWidth = gutterWidth;
+    auto xOff = gutterWidth + m_padding.left() - m_scrollOrigin.x();
+    auto yOff = m_padding.top() - m_scrollOrigin.y();
+    auto fontKey = m_dataSource->defaultFont->getFont().key();
+    auto theme = Perference::shared()->theme()->snapshot();
+
+    frame->serial = ++m_frameSerial;
+    frame->size = size();
+    frame->dpr = devicePixelRatioF();
+    frame->linespace = linespace;
+    frame->gutterWidth = gutterWidth;
+    frame->background = theme->color(ThemeKey::background);
+    frame->foreground = theme->color(ThemeKey::foreground);
+    frame->gutter = theme->color(ThemeKey::gutter);
+    frame->font = m_dataSource->defaultFont->getFont();
+    frame->numbersRight = gutterWidth - 20;
+    auto palette = styles->palette().get();
+
+    qreal maxLineWidth = 0;
+    m_cursorCache.clear();
+    for (auto relLineIx = 0; relLineIx < lines.size(); ++relLineIx) {
+        auto &line = lines[relLineIx];
+        if (!line) continue;
+        auto lineIx = first + relLineIx;
+        auto textLine = layoutLine(line, styles, fontKey, theme->color(ThemeKey::foreground), theme->color(ThemeKey::selection));
+        maxLineWidth = qMax(maxLineWidth, textLine->width());
+        auto y = yOff + metrics->ascent() - linespace + linespace * getRow(lineIx);
+        collectDecorations(frame->decorations, lineIx, line, textLine, *styles, xOff, y, theme->color(ThemeKey::foreground), theme->color(ThemeKey::highlight));
+
+        auto rows = rowsOfLine(lineIx);
+        for (auto subRow = 0; subRow < rows; ++subRow) {
+            auto rowY = y + linespace * subRow;
+            auto shift = wrapX(lineIx, line, textLine, subRow);
+            // recorded here, other threads never touch the TextLine
+            ViewportFrame::Row row;
+            row.pos = QPointF(xOff - shift, rowY);
+            textLine->visit(row.line, row.pos, gutterWidth, width(), palette);
+            if (rows > 1) row.clip = QRectF(0, rowY, width(), linespace);
+            frame->rows.append(row);
+        }
+
+        foreach (int cursor, *line->getCursor()) {
+            auto subRow = m_wordWrap ? m_wrap.subRowOf(lineIx, line->offsets().utf8ToUtf16(cursor)) : 0;
+            auto x0 = xOff + textLine->indexTox(cursor) - wrapX(lineIx, line, textLine, subRow) - 0.5f;
+            auto caretY = y + linespace * subRow;
+            m_cursorCache.push_back(QPoint(x0, caretY));
+        }
+
+        auto top = yOff + metrics->ascent() + linespace * (getRow(lineIx) - 1);
+        frame->numbers.append({top + metrics->leading() + metrics->ascent(), line->number()});
+    }
+    m_maxLineWidth = m_wordWrap ? 0 : maxLineWidth;
+    m_caretOverlay->setCarets(m_cursorCache, linespace, theme->color(ThemeKey::caret));
+
+    if (!fromSnapshot) {
+        auto advance = getAverageCharWidth();
+        for (auto relLineIx = 0; relLineIx < lines.size(); ++relLineIx) {
+            const auto &line = lines[relLineIx];
+            if (line && line->assoc() && !line->isWidthRefined()) {
+                lineCache->refineWidth(first + relLineIx, line->assoc()->width() / advance);
+            }
+        }
+    }
+    reportFirstPaint(fromSnapshot);
+    return frame;
+}
+
+void ContentView::buildGlFrame(GlFrameBuilder &builder, QColor &background) {
+    auto frame = describeFrame();
+    background = frame->background;
+    builder.addFrame(*frame);
+}
+
+void ContentView::frameStarted() {
+    applyScroll();
+    invalidateContent();
+    submitFrame();
+}
+
+GutterState ContentView::gutterState(int gutterWidth, int first, const CacheLines &lines, int themeRevision) {
+    GutterState state;
+    state.width = gutterWidth;
+    state.height = height();
+    state.scrollY = m_scrollOrigin.y();
+    state.linespace = m_dataSource->fontMetrics->height();
+    state.themeRevision = themeRevision;
+    state.dpr = devicePixelRatioF();
+    for (auto relLineIx = 0; relLineIx < lines.size(); ++relLineIx) {
+        const auto &line = lines[relLineIx];
+        state.numbers = qHash(line ? line->number() : -1, state.numbers);
+        state.numbers = qHash(getRow(first + relLineIx), state.numbers);
+    }
+    return state;
+}
+
+RangeI ContentView::linesInRect(const QRect &rect, int totalLines) {
+    auto linespace = m_dataSource->fontMetrics->height();
+    auto firstVisible = qMax(0, (int)(std::ceil((rect.y() - m_padding.top() + m_scrollOrigin.y()) / linespace)));
+    auto lastVisible = qMax(0, (int)(std::ceil((rect.y() + rect.height() - m_padding.top() + m_scrollOrigin.y()) / linespace)));
+
+    // visible rows to the lines they belong to
+    auto first = qMin(totalLines, lineOfRow(firstVisible));
+    auto last = qMin(totalLines, lastVisible > firstVisible ? lineOfRow(lastVisible - 1) + 1 : first);
+    return RangeI(first, last);
+}
+
+// runs as the frame starts, so the numbers compared are the ones paint will see
+void ContentView::invalidateContent() {
+    if (!m_contentDirty) return;
+    m_contentDirty = false;
+    auto region = rect();
+    if (m_gutterState.width > 0) {
+        auto lineCache = m_dataSource->lines->locked();
+        if (!lineCache->isEmpty()) {
+            auto totalLines = lineCache->height();
+            auto range = linesInRect(rect(), totalLines);
+            auto gutterWidth = m_dataSource->gutterOne * QString::number(totalLines).count() + 30;
+            auto themeRevision = Perference::shared()->theme()->snapshot()->revision();
+            if (gutterState(gutterWidth, range.start(), lineCache->linesForRange(range), themeRevision) == m_gutterState) {
+                region = QRect(gutterWidth, 0, width() - gutterWidth, height());
+            }
+        }
+    }
+    scheduler()->invalidate(this, region);
+}
+
+// at most one frame renders and one waits, input never waits for either
+void ContentView::submitFrame() {
+    if (!m_frameRenderer || !m_frameDirty) return;
+    m_frameDirty = false;
+    m_frameRenderer->render(describeFrame());
+}
+
+void ContentView::setRenderThread(bool enabled) {
+    if (enabled == isRenderThread()) return;
+    if (enabled) {
+        setOpenGL(false);
+        m_frameRenderer = std::make_unique<FrameRenderer>();
+        connect(m_frameRenderer.get(), &FrameRenderer::frameReady, this, [this](quint64 serial, const QImage &image) {
+            Q_UNUSED(serial);
+            m_frameImage = image;
+            scheduler()->invalidate(this);
+        });
+    } else {
+        m_frameRenderer.reset();
+        m_frameImage = QImage();
+        m_frameDirty = false;
+        m_cursorCache.clear();
+    }
+    asyncPaint();
+}
+
+void ContentView::setOpenGL(bool enabled) {
+    if (enabled == isOpenGL()) return;
+    if (enabled) {
+        setRenderThread(false);
+        m_gl = new ContentViewOpenGL(this);
+        m_gl->setGeometry(rect());
+        m_gl->show();
+        m_caretOverlay->raise();
+        m_imeComposition->raise();
+    } else {
+        m_gl->deleteLater();
+        m_gl = nullptr;
+        m_cursorCache.clear();
+    }
+    asyncPaint();
+}
+
+void ContentView::paintGutter(QPainter &renderer, const QRect &rect, int first, const CacheLines &lines, const QColor &background, const QColor &foreground) {
+    auto font = m_dataSource->defaultFont->getFont();
+    auto dpr = devicePixelRatioF();
+    if (!m_digits || !m_digits->matches(font, foreground, dpr)) {
+        m_digits.reset(new DigitStrip(font, foreground, dpr));
+    }
+
+    auto linespace = m_dataSource->fontMetrics->height();
+    auto yOff = m_padding.top() - m_scrollOrigin.y();
+    // right aligned, the widest number starts 10px in
+    auto right = rect.width() - 20;
+
+    renderer.fillRect(rect, background);
+    for (auto relLineIx = 0; relLineIx < lines.size(); ++relLineIx) {
         auto line = lines[relLineIx];
         if (!line) continue;
-        auto gutterNumber = line->number();
-        auto x = 10;
-        auto y0 = yOff + m_dataSource->fontMetrics->ascent() + linespace * (lineIx - 1);
-        auto builder = std::make_shared<TextLineBuilder>(QString::number(gutterNumber), font);
-        builder->setFgColor(theme->foreground()); // theme->gutter_foreground()
-        auto textLine = builder->build(true);
-        Painter::drawLine(renderer, textLine, x, y0);
+        auto top = yOff + m_dataSource->fontMetrics->ascent() + linespace * (getRow(first + relLineIx) - 1);
+        auto baseline = top + m_dataSource->fontMetrics->leading() + m_dataSource->fontMetrics->ascent();
+        m_digits->draw(renderer, right, baseline, line->number());
+    }
+}
+
+void ContentView::reportFirstPaint(bool fromSnapshot) {
+    if (!m_firstPaintReported) {
+        m_firstPaintReported = true;
+        Trace::shared()->trace("first_paint", TraceCategory::main, TracePhase::I);
+        if (Trace::shared()->isEnabled()) {
+            qDebug() << "time to first paint:" << m_openTimer.elapsed() << "ms" << (fromSnapshot ? "(snapshot)" : "(live)");
+        }
+    }
+    if (!fromSnapshot && !m_firstLivePaintReported) {
+        m_firstLivePaintReported = true;
+        Trace::shared()->trace("first_live_paint", TraceCategory::main, TracePhase::I);
+        if (Trace::shared()->isEnabled()) {
+            qDebug() << "time to first live paint:" << m_openTimer.elapsed() << "ms";
+        }
+    }
+}
+
+void ContentView::saveSnapshot() {
+    if (m_file->path().isEmpty() || !m_pristine) return;
+
+    auto lineCache = m_dataSource->lines->locked();
+    if (lineCache->isEmpty()) return;
+
+    auto snapshot = std::make_shared<ViewSnapshot>();
+    snapshot->setScrollOrigin(m_scrollOrigin);
+    snapshot->setFirstLine(m_firstLine);
+    snapshot->setTotalLines(lineCache->height());
+
+    QSet<int> styleIds;
+    auto last = qMin(lineCache->height(), m_firstLine + m_visibleLines);
+    for (auto lineIx = m_firstLine; lineIx < last; ++lineIx) {
+        auto line = lineCache->get(lineIx);
+        if (!line) break;
+        snapshot->appendLine(line);
+        auto styles = line->getStyles();
+        for (auto i = 0; i < styles->size(); ++i) {
+            styleIds.insert(styles->style(i));
+        }
+    }
+    if (snapshot->isEmpty()) return;
+
+    auto styleMap = Perference::shared()->styleMap()->locked();
+    foreach (int id, styleIds) {
+        auto json = styleMap->definition(id);
+        if (!json.isEmpty()) snapshot->appendStyleDefinition(json);
+    }
+
+    if (!snapshot->save(m_file->path())) {
+        qWarning() << "failed to save snapshot for" << m_file->path();
     }
 }
 
@@ -279,11 +707,14 @@ int ContentView::getLines() {
 }
 
 qreal ContentView::getMaxLineWidth() {
-    return m_maxLineWidth;
+    if (m_wordWrap) return 0;
+    // widest cached line, not just the visible ones
+    auto maxColumns = m_dataSource->lines->locked()->maxColumns();
+    return qMax(m_maxLineWidth, maxColumns * getAverageCharWidth());
 }
 
 int ContentView::getLinesHeight() {
-    return getLines() * getLinespace();
+    return getRow(getLines()) * getLinespace();
 }
 
 int ContentView::getContentHeight() {
@@ -311,16 +742,126 @@ int ContentView::getXOff() {
 }
 
 int ContentView::getLine(int y) {
-    return qMax(0, (int)(m_scrollOrigin.y() + y - m_padding.top()) / getLinespace());
+    return lineOfRow(qMax(0, (int)(m_scrollOrigin.y() + y - m_padding.top()) / getLinespace()));
 }
 
-int ContentView::getColumn(int line, int x) {
+int ContentView::getColumn(int line, int x, int subRow) {
     auto lineCache = m_dataSource->lines->locked();
     auto cacheLine = lineCache->get(line);
     if (!cacheLine) return -1;
     auto textline = cacheLine->assoc();
     if (!textline) return -1;
-    return textline->xToIndex(m_scrollOrigin.x() + x);
+    return textline->xToIndex(m_scrollOrigin.x() + x + wrapX(line, cacheLine, textline, subRow));
+}
+
+int ContentView::getRow(int line) {
+    return m_wordWrap ? m_wrap.rowOf(line) : line;
+}
+
+int ContentView::lineOfRow(int row) const {
+    return m_wordWrap ? m_wrap.lineAt(row) : row;
+}
+
+int ContentView::rowsOfLine(int line) const {
+    return m_wordWrap ? m_wrap.rowCount(line) : 1;
+}
+
+// x of the first character on row subRow of a wrapped line
+qreal ContentView::wrapX(int lineIx, const std::shared_ptr<Line> &line, const std::shared_ptr<TextLine> &textLine, int subRow) const {
+    if (!m_wordWrap || subRow <= 0) return 0;
+    auto breaks = m_wrap.breaks(lineIx);
+    if (subRow > breaks.size()) return 0;
+    auto start = qMin(breaks[subRow - 1], line->offsets().utf16Length());
+    return textLine->indexTox(line->offsets().utf16ToUtf8(start));
+}
+
+// Adds the find highlights, underlines and squiggles of line, split at wrap breaks.
+// True when the line has a find highlight.
+bool ContentView::collectDecorations(DecorationBatch &batch, int lineIx, const std::shared_ptr<Line> &line, const std::shared_ptr<TextLine> &textLine,
+                                     const StyleTable &styles, qreal x, qreal y, const QColor &foreground, const QColor &highlight) {
+    auto spans = line->getStyles();
+    if (!spans || spans->isEmpty()) return false;
+
+    auto metrics = m_dataSource->fontMetrics;
+    auto linespace = metrics->height();
+    auto top = metrics->leading();
+    auto baseline = top + metrics->ascent();
+    auto thickness = qMax<qreal>(1, metrics->lineWidth());
+    const auto &offsets = line->offsets();
+    auto length = offsets.utf16Length();
+    auto breaks = m_wordWrap ? m_wrap.breaks(lineIx) : QVector<int>();
+
+    auto found = false;
+    for (auto i = 0; i < spans->size(); ++i) {
+        auto id = spans->style(i);
+        const Style *style = nullptr;
+        if (id != 1) {
+            style = styles.style(id);
+            if (!style || !style->isUnderline()) continue;
+        }
+        auto color = style ? (style->fgColor().isValid() ? style->fgColor() : foreground) : highlight;
+        auto range = spans->range(i);
+        for (auto subRow = 0; subRow <= breaks.size(); ++subRow) {
+            auto rowStart = subRow == 0 ? 0 : breaks[subRow - 1];
+            auto rowEnd = subRow < breaks.size() ? breaks[subRow] : length;
+            auto start = qMax(range.start(), rowStart);
+            auto end = qMin(range.end(), rowEnd);
+            if (start >= end) continue;
+
+            auto shift = x - wrapX(lineIx, line, textLine, subRow);
+            auto x0 = shift + textLine->indexTox(offsets.utf16ToUtf8(start));
+            auto x1 = shift + textLine->indexTox(offsets.utf16ToUtf8(end));
+            auto rowY = y + linespace * subRow;
+            if (!style) {
+                batch.addHighlight(QRectF(x0, rowY + top, x1 - x0, metrics->ascent() + metrics->descent()), color);
+                found = true;
+            } else if (style->isSquiggle()) {
+                auto amplitude = qMax<qreal>(1, metrics->descent() / 4);
+                batch.addSquiggle(x0, rowY + baseline + metrics->underlinePos() + amplitude, x1 - x0, amplitude, color);
+            } else {
+                batch.addUnderline(QRectF(x0, rowY + baseline + metrics->underlinePos(), x1 - x0, thickness), color);
+            }
+        }
+    }
+    return found;
+}
+
+void ContentView::syncWrap() {
+    auto columns = 0;
+    {
+        auto config = m_dataSource->config->snapshot();
+        if (config->word_wrap().toBool()) {
+            columns = config->wrap_width().toInt();
+            if (columns <= 0) {
+                columns = int((width() - getXOff() - m_padding.right()) / getAverageCharWidth());
+            }
+            columns = qMax(1, columns);
+        }
+    }
+    m_wordWrap = columns > 0;
+    auto lineCache = m_dataSource->lines->locked();
+    auto changes = lineCache->takeChanges();
+    if (!m_wordWrap) {
+        m_wrap.clear();
+        return;
+    }
+    if (columns == m_wrap.columns() && m_wrap.lineCount() == changes.oldHeight) {
+        if (changes.inPlace) {
+            // edits replace lines in place, only those are rewrapped
+            foreach (const RangeI &range, changes.changed.ranges()) {
+                for (auto ix = range.start(); ix < range.end(); ++ix) {
+                    m_wrap.update(ix, lineCache->get(ix));
+                }
+            }
+        } else {
+            // lines inserted or removed, splice them in at their new indexes
+            m_wrap.move(changes.moves, [&](int ix) {
+                return lineCache->get(ix);
+            });
+        }
+        return;
+    }
+    m_wrap.sync(lineCache->linesForRange(RangeI(0, lineCache->height())), columns);
 }
 
 int ContentView::checkLineVisible(int line) {
@@ -350,8 +891,9 @@ qreal ContentView::getWidth(int lineIx, int columnIx) {
 }
 
 LineColumn ContentView::getLineColumn(const QPoint &pos) {
-    auto line = getLine(pos.y());
-    auto column = getColumn(line, pos.x());
+    auto row = qMax(0, (int)(m_scrollOrigin.y() + pos.y() - m_padding.top()) / getLinespace());
+    auto line = lineOfRow(row);
+    auto column = getColumn(line, pos.x(), row - getRow(line));
     auto lineCache = m_dataSource->lines->locked();
     auto totalLines = lineCache->height();
     if (line >= totalLines) {
@@ -367,43 +909,100 @@ void ContentView::scrollY(int y) {
     auto lines = getLines();
     if (lines == 0) return;
 
-    constexpr auto kMaxPrefetch = 1;
     const int kLines = m_visibleLines * kMaxPrefetch;
 
-    auto first = qMax(0, (int)(std::floor(value / qreal(linespace) + 0.9))); // last line [visible]
-    first = qMin(lines - 1, first);
+    auto firstRow = qMax(0, (int)(std::floor(value / qreal(linespace) + 0.9))); // last line [visible]
+    firstRow = qMin(getRow(lines) - 1, firstRow);
+    auto first = lineOfRow(firstRow);
+    auto origin = m_scrollOrigin;
     if (m_firstLine != first) {
         m_firstLine = first;
         RangeI prefetch(qMax(0, m_firstLine - kLines), qMin(lines, m_firstLine + m_visibleLines + kLines));
         m_connection->sendScroll(m_file->viewId(), prefetch.start(), prefetch.end());
+        prefetchLayout();
     }
-    m_scrollOrigin.setY(m_firstLine * linespace);
-    update();
+    m_scrollOrigin.setY(firstRow * linespace);
+    blitScroll(origin - m_scrollOrigin);
     //repaint();
     //asyncPaint();
 }
 
+void ContentView::blitScroll(const QPoint &delta) {
+    if (delta.isNull()) return;
+    m_pendingScroll += delta;
+    scheduler()->requestFrame();
+}
+
+void ContentView::applyScroll() {
+    auto delta = m_pendingScroll;
+    if (delta.isNull()) return;
+    m_pendingScroll = QPoint();
+    if (m_gl || m_frameRenderer) {
+        asyncPaint(); // drawn whole every frame
+        return;
+    }
+    auto gutterWidth = m_dataSource->gutterWidth;
+    if (!m_scrollBlitting || qAbs(delta.y()) >= height() || qAbs(delta.x()) >= width() - gutterWidth) {
+        asyncPaint(); // joins the frame that is starting
+        return;
+    }
+    // the gutter travels with its lines vertically and stays put horizontally,
+    // child widgets stay put either way
+    if (delta.y() != 0) {
+        scroll(0, delta.y(), rect());
+    }
+    if (delta.x() != 0) {
+        scroll(delta.x(), 0, QRect(gutterWidth, 0, width() - gutterWidth, height()));
+    }
+    for (auto &pos : m_cursorCache) {
+        pos += delta;
+    }
+    if (m_imeComposition->isVisible()) {
+        m_imeComposition->move(m_imeComposition->pos() + delta);
+    }
+    m_caretOverlay->setCarets(m_cursorCache, getLinespace(), Perference::shared()->theme()->snapshot()->color(ThemeKey::caret));
+}
+
+void ContentView::prefetchLayout() {
+    auto kLines = m_visibleLines * kMaxPrefetch;
+    RangeI range(qMax(0, m_firstLine - kLines), qMin(getLines(), m_firstLine + m_visibleLines + kLines));
+    if (range.isEmpty()) return;
+
+    LayoutInputs inputs;
+    inputs.font = m_dataSource->defaultFont;
+    inputs.styleMap = Perference::shared()->styleMap();
+    {
+        auto theme = Perference::shared()->theme()->snapshot();
+        inputs.foreground = theme->color(ThemeKey::foreground);
+        inputs.selection = theme->color(ThemeKey::selection);
+    }
+    m_prefetcher->prefetch(range, inputs);
+}
+
 void ContentView::scrollX(int x) {
+    auto origin = m_scrollOrigin;
     m_scrollOrigin.setX(x);
     //repaint();
-    update();
+    blitScroll(origin - m_scrollOrigin);
     //asyncPaint();
 }
 
 void ContentView::updateHandler(const QJsonObject &json) {
+    if (json.contains("pristine")) {
+        m_pristine = json["pristine"].toBool();
+    }
     QtConcurrent::run(QThreadPool::globalInstance(), [this, json]() {
         this->m_dataSource->lines->locked()->applyUpdate(json);
         emit repaintContentReceived();
     });
-    repaint(); // update assoc
+    asyncPaint();
 }
 
 void ContentView::scrollHandler(int line, int column) {
     Q_UNUSED(line);
     Q_UNUSED(column);
 
-    //repaint();
-    update();
+    asyncPaint();
 }
 
 void ContentView::keyPressEvent(QKeyEvent *ev) {
@@ -653,14 +1252,40 @@ void ContentView::paste() {
     });
 }
 
-void ContentView::asyncPaint(int ms /*= 100*/) {
-    Q_UNUSED(ms);
+void ContentView::asyncPaint() {
+    if (m_frameRenderer) {
+        m_frameDirty = true;
+        scheduler()->requestFrame();
+        return;
+    }
+    if (m_gl) {
+        scheduler()->invalidate(m_gl);
+        return;
+    }
+    m_contentDirty = true;
+    scheduler()->requestFrame();
+}
 
-    using namespace std::chrono;
-    auto timestamp = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
-    m_asyncPaintQueue.enqueue(timestamp);
+void ContentView::asyncPaint(const QRect &rect) {
+    if (m_gl || m_frameRenderer) {
+        asyncPaint(); // drawn whole every frame
+        return;
+    }
+    scheduler()->invalidate(this, rect);
+}
+
+// follows the view into whichever window holds it
+FrameScheduler *ContentView::scheduler() {
+    auto scheduler = FrameScheduler::of(this);
+    if (scheduler != m_scheduler) {
+        if (m_scheduler) disconnect(m_scheduler, nullptr, this, nullptr);
+        connect(scheduler, &FrameScheduler::frameStarted, this, &ContentView::frameStarted);
+        m_scheduler = scheduler;
+    }
+    return scheduler;
 }
 
+// laid out lines stay, they take the new colors from the style table's palette
 void ContentView::themeChangedHandler() {
     //repaint();
     emit repaintContentReceived();
@@ -669,12 +1294,24 @@ void ContentView::themeChangedHandler() {
 void ContentView::configChangedHandler(const QJsonObject &changes) {
     QtConcurrent::run(QThreadPool::globalInstance(), [=]() {
         m_dataSource->config->locked()->applyUpdate(changes);
+        emit repaintContentReceived(); // word_wrap may have changed
     });
 }
 
 void ContentView::repaintContentHandler() {
-    update();
-    //repaint();
+    auto wrapped = m_wordWrap;
+    syncWrap();
+    auto editView = dynamic_cast<EditView *>(parent());
+    if (m_snapshot && !m_dataSource->lines->isEmpty()) {
+        // real lines landed, hand the scroll position over to the scroll bars
+        auto origin = m_snapshot->scrollOrigin();
+        m_snapshot.reset();
+        if (editView) editView->restoreScrollOrigin(origin);
+    } else if (editView && (wrapped || m_wordWrap)) {
+        editView->relayoutScrollBar(); // row count follows the wrap
+    }
+    prefetchLayout();
+    asyncPaint();
 }
 
 qreal ContentView::getAverageWidth(int line, int column) {
@@ -690,9 +1327,9 @@ QMarginsF ContentView::getPadding() {
     return m_padding;
 }
 
-void ContentView::tick() {
+void ContentView::tick(qint64 paintNs) {
     auto editView = dynamic_cast<EditView *>(parent());
-    editView->tick();
+    editView->tick(paintNs);
 }
 
 void ContentView::inputMethodEvent(QInputMethodEvent *event) {
@@ -730,29 +1367,13 @@ QVariant ContentView::inputMethodQuery(Qt::InputMethodQuery query) const {
     } else if (query == Qt::ImFont) {
         return m_imeComposition->font();
     } else if (query == Qt::ImCursorRectangle) {
-        if (!m_cursorCache.isEmpty()) {
-            int h = m_dataSource->fontMetrics->height();
-            auto pos = m_cursorCache.front();
-            return QRect(pos, QSize(2, h));
+        if (!m_caretOverlay->carets().isEmpty()) {
+            return m_caretOverlay->carets().front();
         }
     }
     return QVariant();
 }
 
-AsyncPaintTimer::AsyncPaintTimer(QWidget *parent) {
-    m_timer = std::make_unique<QTimer>(this);
-    m_timer->start(10);
-    connect(m_timer.get(), &QTimer::timeout, this, &AsyncPaintTimer::update);
-    m_contentView = reinterpret_cast<ContentView *>(parent);
-}
-
-void AsyncPaintTimer::update() {
-    if (m_contentView->m_asyncPaintQueue.size() != 0) {
-        m_contentView->update();
-        m_contentView->m_asyncPaintQueue.clear();
-    }
-}
-
 DataSource::DataSource() {
     lines = std::make_shared<LineCache>();
     config = std::make_shared<Config>();
@@ -773,4 +1394,51 @@ DataSource::DataSource() {
     gutterWidth = gutterOne;
 }
 
+ContentViewOpenGL::ContentViewOpenGL(ContentView *view) : QOpenGLWidget(view), m_view(view) {
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+    setAttribute(Qt::WA_InputMethodTransparent);
+    setFocusPolicy(Qt::NoFocus);
+    // instancing needs 3.3, which Mesa only hands out as a core profile
+    if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGL) {
+        auto format = QSurfaceFormat::defaultFormat();
+        format.setVersion(3, 3);
+        format.setProfile(QSurfaceFormat::CoreProfile);
+        setFormat(format);
+    }
+}
+
+ContentViewOpenGL::~ContentViewOpenGL() {
+    makeCurrent();
+    m_renderer.release();
+    doneCurrent();
+}
+
+void ContentViewOpenGL::initializeGL() {
+    if (!m_renderer.initialize()) {
+        qDebug() << "OpenGL renderer unavailable on" << context()->format().version() << ", back to raster";
+        auto view = m_view;
+        QTimer::singleShot(0, view, [view]() {
+            view->setOpenGL(false);
+        });
+    }
+}
+
+void ContentViewOpenGL::paintGL() {
+    if (!m_renderer.isValid()) return;
+    QElapsedTimer timer;
+    timer.start();
+    auto dpr = devicePixelRatioF();
+    GlFrameBuilder builder(m_atlas, dpr);
+    QColor background;
+    m_view->buildGlFrame(builder, background);
+    if (builder.overflowed()) {
+        // glyphs in use since the atlas filled up, start over with just those
+        m_atlas.clear();
+        builder.clear();
+        m_view->buildGlFrame(builder, background);
+    }
+    m_renderer.render(builder.quads(), background, QSize(std::ceil(width() * dpr), std::ceil(height() * dpr)), m_atlas);
+    m_view->tick(timer.nsecsElapsed());
+}
+
 } // namespace xi
@@ -2,24 +2,34 @@
 #define CONTENT_VIEW_H
 
 #include <QAbstractScrollArea>
+#include <QElapsedTimer>
 #include <QFontMetrics>
 #include <QFontMetricsF>
+#include <QFutureWatcher>
 #include <QGridLayout>
 #include <QMargins>
 #include <QOpenGLFunctions>
 #include <QOpenGLWidget>
 #include <QPoint>
-#include <QQueue>
 #include <QScrollArea>
 #include <QTimer>
 #include <QLabel>
 
 #include <memory>
 
+#include "caret_overlay.h"
 #include "core_connection.h"
+#include "decoration.h"
+#include "digit_strip.h"
 #include "file.h"
+#include "frame_renderer.h"
+#include "frame_scheduler.h"
+#include "gl_text_renderer.h"
 #include "font.h"
+#include "layout_prefetcher.h"
 #include "line_cache.h"
+#include "snapshot.h"
+#include "wrap_index.h"
 
 namespace xi {
 
@@ -64,19 +74,27 @@ private:
 
 class ContentView;
 
-class AsyncPaintTimer : public QObject {
-    Q_OBJECT
-public:
-    AsyncPaintTimer(QWidget *parent);
-
-public slots:
-    void update();
-
-private:
-    ContentView *m_contentView = nullptr;
-    std::unique_ptr<QTimer> m_timer;
+// what the gutter showed after its last full height paint
+struct GutterState {
+    int width = 0;
+    int height = 0;
+    int scrollY = 0;
+    qreal linespace = 0;
+    int themeRevision = 0;
+    qreal dpr = 0;
+    uint numbers = 0; // hash of the visible line numbers
+
+    inline bool operator==(const GutterState &other) const {
+        return width == other.width && height == other.height && scrollY == other.scrollY && linespace == other.linespace &&
+               themeRevision == other.themeRevision && qFuzzyCompare(dpr, other.dpr) && numbers == other.numbers;
+    }
+    inline bool operator!=(const GutterState &other) const {
+        return !(*this == other);
+    }
 };
 
+class ContentViewOpenGL;
+
 #define SEND_EDIT_METHOD(TypeName) \
     void TypeName() { sendEdit(m_selectorToCommand[#TypeName]); }
 
@@ -84,7 +102,7 @@ private:
 class ContentView : public QWidget {
     Q_OBJECT
 public:
-    friend class AsyncPaintTimer;
+    friend class ContentViewOpenGL;
 
 public:
     ContentView(std::shared_ptr<File> file, std::shared_ptr<CoreConnection> connection, QWidget *parent);
@@ -104,8 +122,31 @@ protected:
     void showImeComposition(const QString &text);
 
     void paint(QPainter &renderer, const QRect &dirtyRect);
+    void paintLines(QPainter &renderer, const QRect &dirtyRect, int first, const CacheLines &lines, int totalLines, const std::shared_ptr<const StyleTable> &styles);
+    void syncWrap();
+    int lineOfRow(int row) const;
+    int rowsOfLine(int line) const;
+    qreal wrapX(int lineIx, const std::shared_ptr<Line> &line, const std::shared_ptr<TextLine> &textLine, int subRow) const;
+    bool collectDecorations(DecorationBatch &batch, int lineIx, const std::shared_ptr<Line> &line, const std::shared_ptr<TextLine> &textLine,
+                            const StyleTable &styles, qreal x, qreal y, const QColor &foreground, const QColor &highlight);
+    void paintGutter(QPainter &renderer, const QRect &rect, int first, const CacheLines &lines, const QColor &background, const QColor &foreground);
+    GutterState gutterState(int gutterWidth, int first, const CacheLines &lines, int themeRevision);
+    // lines crossing the rows of rect
+    RangeI linesInRect(const QRect &rect, int totalLines);
+    // a whole view repaint, the gutter left out while what it shows is unchanged
+    void invalidateContent();
+    void reportFirstPaint(bool fromSnapshot);
     void initSelectCommand();
-    void tick();
+    void tick(qint64 paintNs);
+    std::shared_ptr<TextLine> layoutLine(const std::shared_ptr<Line> &line, const std::shared_ptr<const StyleTable> &styles, const QString &fontKey,
+                                         const QColor &foreground, const QColor &selection);
+    // what paintLines draws for the whole view, for the render thread and OpenGL
+    std::shared_ptr<ViewportFrame> describeFrame();
+    void buildGlFrame(GlFrameBuilder &builder, QColor &background);
+    FrameScheduler *scheduler();
+    void frameStarted();
+    void applyScroll();
+    void submitFrame();
 
 public:
     std::shared_ptr<File> getFile() const;
@@ -122,7 +163,9 @@ public:
     int getXOff();
 
     int getLine(int y);
-    int getColumn(int line, int x);
+    int getColumn(int line, int x, int subRow = 0);
+    // first visual row of line, lines are one row each unless word_wrap is on
+    int getRow(int line);
 
     int checkLineVisible(int line);
 
@@ -131,10 +174,34 @@ public:
     LineColumn getLineColumn(const QPoint &pos);
     ClosedRangeI getVisibleLinesRange(const QRect &bound);
 
-    void asyncPaint(int ms = 100);
+    // repaint on the next frame of the window
+    void asyncPaint();
+    void asyncPaint(const QRect &rect);
 
     void scrollY(int y);
     void scrollX(int x);
+    // shift the pixels on screen, only exposed strips get painted.
+    // Deltas add up until the next frame.
+    void blitScroll(const QPoint &delta);
+    inline bool scrollBlitting() const {
+        return m_scrollBlitting;
+    }
+    inline void setScrollBlitting(bool enabled) {
+        m_scrollBlitting = enabled;
+    }
+    // draw through ContentViewOpenGL instead of QPainter
+    void setOpenGL(bool enabled);
+    inline bool isOpenGL() const {
+        return m_gl != nullptr;
+    }
+    // rasterize on FrameRenderer's thread, paint only blits the result
+    void setRenderThread(bool enabled);
+    inline bool isRenderThread() const {
+        return m_frameRenderer != nullptr;
+    }
+    void prefetchLayout();
+
+    void saveSnapshot();
 
     void sendEdit(const QString &method);
 
@@ -208,6 +275,12 @@ public:
 private:
     std::unique_ptr<QLabel> m_imeComposition;
     QVector<QPoint> m_cursorCache;
+    CaretOverlay *m_caretOverlay; // draws m_cursorCache, above the text
+    std::unique_ptr<DigitStrip> m_digits;
+    GutterState m_gutterState;
+    bool m_contentDirty = false; // for invalidateContent
+    WrapIndex m_wrap;
+    bool m_wordWrap = false;
     std::shared_ptr<File> m_file;
     std::shared_ptr<CoreConnection> m_connection;
     std::shared_ptr<DataSource> m_dataSource; //owned
@@ -219,14 +292,41 @@ private:
     QMarginsF m_padding;
     bool m_drag = false;
     QTimer m_mouseDoubleCheckTimer;
-    std::unique_ptr<AsyncPaintTimer> m_asyncPaintTimer;
-    QQueue<qint64> m_asyncPaintQueue;
+    std::unique_ptr<LayoutPrefetcher> m_prefetcher;
+    QPointer<FrameScheduler> m_scheduler;
+    QPoint m_pendingScroll; // blitted on the next frame
+    ContentViewOpenGL *m_gl = nullptr;
+    std::unique_ptr<FrameRenderer> m_frameRenderer;
+    QImage m_frameImage;     // last frame from the render thread
+    bool m_frameDirty = false; // a newer frame is needed
+    quint64 m_frameSerial = 0;
+    int m_shapeRevision = 0; // StyleTable::shapeRevision() of the lines' assoc
+    std::shared_ptr<ViewSnapshot> m_snapshot;
+    QFutureWatcher<std::shared_ptr<ViewSnapshot>> m_snapshotLoader; // read and uncompressed off the GUI thread
+    int m_snapshotLineRevision = 0; // line cache revision when the load started
+    QElapsedTimer m_openTimer;
+    QElapsedTimer m_statsTimer;
+    bool m_firstPaintReported = false;
+    bool m_firstLivePaintReported = false;
+    bool m_pristine = true;
+    bool m_scrollBlitting = true;
 };
 
-// focus performance
-class ContentViewOpenGL : public QOpenGLWidget, protected QOpenGLFunctions {
+// OpenGL backend, covers its ContentView and draws the frames it describes.
+// Input still goes to the ContentView underneath.
+class ContentViewOpenGL : public QOpenGLWidget {
 public:
+    explicit ContentViewOpenGL(ContentView *view);
+    ~ContentViewOpenGL();
+
+protected:
+    virtual void initializeGL() override;
+    virtual void paintGL() override;
+
 private:
+    ContentView *m_view;
+    GlGlyphAtlas m_atlas;
+    GlTextRenderer m_renderer;
 };
 
 } // namespace xi
@@ -0,0 +1,99 @@
+#include "decoration.h"
+
+#include <cmath>
+
+namespace xi {
+
+void DecorationBatch::addHighlight(const QRectF &rect, const QColor &color) {
+    if (rect.isEmpty()) return;
+    m_highlights[color.rgba()].append(rect);
+}
+
+void DecorationBatch::addUnderline(const QRectF &rect, const QColor &color) {
+    if (rect.isEmpty()) return;
+    m_underlines[color.rgba()].append(rect);
+}
+
+void DecorationBatch::addSquiggle(qreal x, qreal y, qreal width, qreal amplitude, const QColor &color) {
+    if (width <= 0) return;
+    // peaks on a fixed grid, so touching spans join into one wave
+    auto step = qMax<qreal>(2, amplitude * 2);
+    auto yAt = [&](qreal px) {
+        auto phase = px / step;
+        auto k = std::floor(phase);
+        auto peak = (qint64(k) & 1) ? amplitude : -amplitude;
+        return y + peak - 2 * peak * (phase - k);
+    };
+    auto end = x + width;
+    auto &lines = m_squiggles[color.rgba()];
+    QPointF from(x, yAt(x));
+    for (auto k = std::floor(x / step) + 1; from.x() < end; ++k) {
+        auto nextX = qMin(k * step, end);
+        QPointF to(nextX, yAt(nextX));
+        lines.append(QLineF(from, to));
+        from = to;
+    }
+}
+
+void DecorationBatch::clear() {
+    m_highlights.clear();
+    m_underlines.clear();
+    m_squiggles.clear();
+}
+
+void DecorationBatch::fillRects(QPainter &painter, const QHash<QRgb, QVector<QRectF>> &rects) {
+    for (auto it = rects.cbegin(); it != rects.cend(); ++it) {
+        painter.setBrush(QColor::fromRgba(it.key()));
+        painter.drawRects(it.value());
+    }
+}
+
+void DecorationBatch::drawBehindText(QPainter &painter) const {
+    if (m_highlights.isEmpty()) return;
+    painter.save();
+    painter.setPen(Qt::NoPen);
+    fillRects(painter, m_highlights);
+    painter.restore();
+}
+
+void DecorationBatch::drawOverText(QPainter &painter) const {
+    if (m_underlines.isEmpty() && m_squiggles.isEmpty()) return;
+    painter.save();
+    painter.setPen(Qt::NoPen);
+    fillRects(painter, m_underlines);
+    painter.setBrush(Qt::NoBrush);
+    painter.setRenderHint(QPainter::Antialiasing);
+    for (auto it = m_squiggles.cbegin(); it != m_squiggles.cend(); ++it) {
+        painter.setPen(QPen(QColor::fromRgba(it.key()), 1));
+        painter.drawLines(it.value());
+    }
+    painter.restore();
+}
+
+void DecorationBatch::visitBehindText(TextLineVisitor &visitor) const {
+    for (auto it = m_highlights.cbegin(); it != m_highlights.cend(); ++it) {
+        for (const QRectF &rect : it.value()) {
+            visitor.rect(rect, QColor::fromRgba(it.key()));
+        }
+    }
+}
+
+void DecorationBatch::visitOverText(TextLineVisitor &visitor) const {
+    for (auto it = m_underlines.cbegin(); it != m_underlines.cend(); ++it) {
+        for (const QRectF &rect : it.value()) {
+            visitor.rect(rect, QColor::fromRgba(it.key()));
+        }
+    }
+    for (auto it = m_squiggles.cbegin(); it != m_squiggles.cend(); ++it) {
+        auto color = QColor::fromRgba(it.key());
+        for (const QLineF &line : it.value()) {
+            auto steps = qMax(1, int(std::ceil(line.dx())));
+            for (auto i = 0; i < steps; ++i) {
+                auto p = line.pointAt((i + 0.5) / steps);
+                visitor.rect(QRectF(p.x() - line.dx() / steps / 2, p.y() - 0.5, line.dx() / steps, 1), color);
+            }
+        }
+    }
+}
+
+} // namespace xi
@@ -0,0 +1,47 @@
+#ifndef DECORATION_H
+#define DECORATION_H
+
+#include <QColor>
+#include <QHash>
+#include <QLineF>
+#include <QPainter>
+#include <QRectF>
+#include <QVector>
+
+#include "text_line.h"
+
+namespace xi {
+
+// Underlines, squiggles and find highlights of every visible row, grouped by
+// color so each group is one QPainter call instead of one per span
+class DecorationBatch {
+public:
+    void addHighlight(const QRectF &rect, const QColor &color);
+    void addUnderline(const QRectF &rect, const QColor &color);
+    // wave along [x, x + width) centered on y
+    void addSquiggle(qreal x, qreal y, qreal width, qreal amplitude, const QColor &color);
+
+    inline bool isEmpty() const {
+        return m_highlights.isEmpty() && m_underlines.isEmpty() && m_squiggles.isEmpty();
+    }
+    void clear();
+
+    // find highlights, between the background and the text
+    void drawBehindText(QPainter &painter) const;
+    // underlines and squiggles
+    void drawOverText(QPainter &painter) const;
+    // the same as rects, squiggles in one pixel steps
+    void visitBehindText(TextLineVisitor &visitor) const;
+    void visitOverText(TextLineVisitor &visitor) const;
+
+private:
+    static void fillRects(QPainter &painter, const QHash<QRgb, QVector<QRectF>> &rects);
+
+    QHash<QRgb, QVector<QRectF>> m_highlights;
+    QHash<QRgb, QVector<QRectF>> m_underlines;
+    QHash<QRgb, QVector<QLineF>> m_squiggles;
+};
+
+} // namespace xi
+
+#endif // DECORATION_H
@@ -0,0 +1,51 @@
+#include "digit_strip.h"
+
+#include <QFontMetricsF>
+
+#include <cmath>
+
+namespace xi {
+
+DigitStrip::DigitStrip(const QFont &font, const QColor &color, qreal dpr) : m_fontKey(font.key()), m_color(color), m_dpr(dpr) {
+    QFontMetricsF metrics(font);
+    qreal advance = 0;
+    for (auto digit = 0; digit < 10; ++digit) {
+        advance = qMax(advance, metrics.width(QChar('0' + digit)));
+    }
+    // whole device pixels per cell, so every digit is an exact blit
+    m_cellPixels = qMax(1, int(std::ceil(advance * dpr)));
+    m_heightPixels = qMax(1, int(std::ceil((metrics.ascent() + metrics.descent()) * dpr)));
+    m_ascent = metrics.ascent();
+
+    m_pixmap = QPixmap(m_cellPixels * 10, m_heightPixels);
+    m_pixmap.setDevicePixelRatio(dpr);
+    m_pixmap.fill(Qt::transparent);
+
+    QPainter painter(&m_pixmap);
+    painter.setFont(font);
+    painter.setPen(color);
+    for (auto digit = 0; digit < 10; ++digit) {
+        painter.drawText(QPointF(digit * cellWidth(), m_ascent), QString(QChar('0' + digit)));
+    }
+}
+
+bool DigitStrip::matches(const QFont &font, const QColor &color, qreal dpr) const {
+    return m_color == color && qFuzzyCompare(m_dpr, dpr) && m_fontKey == font.key();
+}
+
+qreal DigitStrip::draw(QPainter &painter, qreal right, qreal baseline, int number) const {
+    if (number < 0) return right;
+
+    auto cell = cellWidth();
+    auto x = right;
+    auto top = baseline - m_ascent;
+    do {
+        x -= cell;
+        auto digit = number % 10;
+        painter.drawPixmap(QPointF(x, top), m_pixmap, QRectF(digit * m_cellPixels, 0, m_cellPixels, m_heightPixels));
+        number /= 10;
+    } while (number > 0);
+    return x;
+}
+
+} // namespace xi
@@ -0,0 +1,40 @@
+#ifndef DIGIT_STRIP_H
+#define DIGIT_STRIP_H
+
+#include <QColor>
+#include <QFont>
+#include <QPainter>
+#include <QPixmap>
+#include <QString>
+
+namespace xi {
+
+// Digits 0-9 of one font and color, rendered once side by side in equal cells.
+// Line numbers are blitted from it digit by digit, no shaping or layout.
+class DigitStrip {
+public:
+    DigitStrip(const QFont &font, const QColor &color, qreal dpr);
+
+    bool matches(const QFont &font, const QColor &color, qreal dpr) const;
+
+    // logical width of one digit cell
+    inline qreal cellWidth() const {
+        return m_cellPixels / m_dpr;
+    }
+
+    // right aligned to right, returns the left edge of the number
+    qreal draw(QPainter &painter, qreal right, qreal baseline, int number) const;
+
+private:
+    QPixmap m_pixmap;
+    QString m_fontKey;
+    QColor m_color;
+    qreal m_dpr;
+    qreal m_ascent = 0;
+    int m_cellPixels = 0;
+    int m_heightPixels = 0;
+};
+
+} // namespace xi
+
+#endif // DIGIT_STRIP_H
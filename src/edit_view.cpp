@@ -3,6 +3,7 @@
 #include <QAbstractScrollArea>
 #include <QApplication>
 #include <QClipboard>
+#include <QDebug>
 #include <QFontMetrics>
 #include <QFontMetricsF>
 #include <QGridLayout>
@@ -13,8 +14,11 @@
 #include <QScrollArea>
 #include <QScrollBar>
 
+#include <algorithm>
 #include <cmath>
 
+#include "benchmark.h"
+#include "frame_scheduler.h"
 #include "content_view.h"
 #include "edit_window.h"
 #include "perference.h"
@@ -64,6 +68,24 @@ EditView::EditView(std::shared_ptr<File> file, std::shared_ptr<CoreConnection> c
                 this, &EditView::scrollTester);
     });
 
+    Shortcuts::shared()->append(this, QKeySequence("F9"), [&](QShortcut *shortcut) {
+        shortcut->setContext(Qt::WidgetWithChildrenShortcut);
+        connect(shortcut, &QShortcut::activated,
+                this, &EditView::benchmark);
+    });
+
+    Shortcuts::shared()->append(this, QKeySequence("F10"), [&](QShortcut *shortcut) {
+        shortcut->setContext(Qt::WidgetWithChildrenShortcut);
+        connect(shortcut, &QShortcut::activated,
+                this, &EditView::toggleOpenGL);
+    });
+
+    Shortcuts::shared()->append(this, QKeySequence("F11"), [&](QShortcut *shortcut) {
+        shortcut->setContext(Qt::WidgetWithChildrenShortcut);
+        connect(shortcut, &QShortcut::activated,
+                this, &EditView::toggleRenderThread);
+    });
+
     m_fpsCounter = new FpsCounterWidget(this);
 }
 
@@ -79,15 +101,16 @@ void EditView::updateHandler(const QJsonObject &json) {
 void EditView::scrollHandler(int line, int column) {
     auto linespace = m_content->getLinespace();
     auto vValue = m_scrollBarV->value();
-    auto nextLine = line + 1;
+    auto row = m_content->getRow(line);
+    auto nextRow = row + 1;
 
     relayoutScrollBar();
 
-    if (nextLine * linespace > vValue + m_content->height()) {
-        m_scrollBarV->setValue(nextLine * linespace - m_content->height());
+    if (nextRow * linespace > vValue + m_content->height()) {
+        m_scrollBarV->setValue(nextRow * linespace - m_content->height());
     }
-    if (line * linespace < vValue) {
-        m_scrollBarV->setValue(line * linespace);
+    if (row * linespace < vValue) {
+        m_scrollBarV->setValue(row * linespace);
     }
 
     auto scrollOriginX = m_content->getScrollOrigin().x();
@@ -155,6 +178,18 @@ void EditView::relayoutScrollBar() {
     m_scrollBarH->setVisible(true);
 }
 
+void EditView::restoreScrollOrigin(const QPoint &origin) {
+    relayoutScrollBar();
+    m_scrollBarV->setValue(origin.y());
+    m_scrollBarH->setValue(origin.x());
+    m_content->scrollY(m_scrollBarV->value());
+    m_content->scrollX(m_scrollBarH->value());
+}
+
+void EditView::saveSnapshot() {
+    m_content->saveSnapshot();
+}
+
 void EditView::wheelEvent(QWheelEvent *event) {
     if (m_scrollBarV->isVisible()) {
         auto linespace = m_content->getLinespace();
@@ -173,8 +208,9 @@ void EditView::focusOnEdit() {
     //m_content->update();
 }
 
-void EditView::tick() {
+void EditView::tick(qint64 paintNs) {
     m_fpsCounter->tick();
+    m_scrollTester->frame(paintNs);
 }
 
 void EditView::scrollBarVChanged(int y) {
@@ -191,6 +227,19 @@ void EditView::scrollTester() {
     m_scrollTester->mode();
 }
 
+void EditView::benchmark() {
+    Benchmark::shared()->run();
+}
+
+void EditView::toggleOpenGL() {
+    m_content->setOpenGL(!m_content->isOpenGL());
+    m_fpsCounter->raise();
+}
+
+void EditView::toggleRenderThread() {
+    m_content->setRenderThread(!m_content->isRenderThread());
+}
+
 ScrollTester::ScrollTester(EditView *view) : m_view(view) {
     m_timer = std::make_unique<QTimer>(this);
     connect(m_timer.get(), &QTimer::timeout, this, &ScrollTester::update);
@@ -203,16 +252,49 @@ ScrollTester::~ScrollTester() {
 
 void ScrollTester::mode() {
     if (m_state == NotRunning) {
+        m_blittingWasEnabled = m_view->m_content->scrollBlitting();
+        m_view->m_content->setScrollBlitting(false);
+        m_frameTimes.clear();
+        m_ticks = 0;
         m_timer->start(5);
         m_state = Running;
     } else if (m_state == Running) {
         m_timer->stop();
         m_state = NotRunning;
+        m_view->m_content->setScrollBlitting(m_blittingWasEnabled);
     }
 }
 
+void ScrollTester::frame(qint64 paintNs) {
+    if (m_state == Running) {
+        m_frameTimes.append(paintNs);
+    }
+}
+
+void ScrollTester::report(const QString &phase) {
+    if (m_frameTimes.isEmpty()) return;
+    std::sort(m_frameTimes.begin(), m_frameTimes.end());
+    qint64 total = 0;
+    foreach (qint64 t, m_frameTimes) {
+        total += t;
+    }
+    qDebug() << "scroll test" << phase << m_frameTimes.size() << "frames, paint avg"
+             << total / 1'000'000.0 / m_frameTimes.size() << "ms, p95"
+             << m_frameTimes[m_frameTimes.size() * 95 / 100] / 1'000'000.0 << "ms";
+    m_frameTimes.clear();
+}
+
 void ScrollTester::update() {
     if (m_view) {
+        ++m_ticks;
+        if (m_ticks == kPhaseTicks) {
+            report("full repaint:");
+            m_view->m_content->setScrollBlitting(true);
+        } else if (m_ticks == 2 * kPhaseTicks) {
+            report("blitted:");
+            mode();
+            return;
+        }
         auto value = m_view->m_scrollBarV->value();
         if (value == m_view->m_scrollBarV->maximum()) {
             m_direction = Up;
@@ -232,9 +314,12 @@ FpsCounterWidget::FpsCounterWidget(QWidget *parent /*= nullptr*/) : QWidget(pare
     setAttribute(Qt::WA_InputMethodTransparent);
 
     m_view = dynamic_cast<EditView *>(parent);
-    m_timer = std::make_unique<QTimer>(this);
-    connect(m_timer.get(), &QTimer::timeout, this, &FpsCounterWidget::update);
-    m_timer->start(100);
+    m_clock.start();
+    // one last repaint to show the count dropping once frames stop
+    m_idleTimer.setSingleShot(true);
+    connect(&m_idleTimer, &QTimer::timeout, this, [this]() {
+        FrameScheduler::of(this)->invalidate(this);
+    });
 
     QString family = FPS_FONT;
     int size = 11;
@@ -250,28 +335,19 @@ FpsCounterWidget::FpsCounterWidget(QWidget *parent /*= nullptr*/) : QWidget(pare
     setContentsMargins(0, 0, 0, 0);
 }
 
-void FpsCounterWidget::update() {
-    m_tickCache = m_tick;
-    m_tick = 0;
-    m_update = true;
-    repaint();
+void FpsCounterWidget::expire() {
+    auto now = m_clock.elapsed();
+    while (!m_frames.isEmpty() && m_frames.head() <= now - kWindowMs) {
+        m_frames.dequeue();
+    }
 }
 
 void FpsCounterWidget::paintEvent(QPaintEvent *event) {
     Q_UNUSED(event);
     QPainter painter(this);
-    if (m_update) {
-        using namespace std::chrono;
-        auto timestamp = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
-        auto timeDuration = (timestamp - m_current); // /1000000.f
-        int fps = std::floor(qreal(m_tickCache) * 1000000 / timeDuration + 0.499);
-        m_current = timestamp;
-        m_update = false;
-        if (fps != 0)
-            m_fpsCache = fps;
-    }
+    expire();
     auto bgrc = rect();
-    QString fpsString = QString::number(m_fpsCache);
+    QString fpsString = QString::number(m_frames.size());
 
     // 1, 80, 198
     // 128, 128, 128
@@ -285,7 +361,14 @@ void FpsCounterWidget::resizeEvent(QResizeEvent *event) {
 }
 
 void FpsCounterWidget::tick() {
-    ++m_tick;
+    auto now = m_clock.elapsed();
+    m_frames.enqueue(now);
+    expire();
+    if (now - m_shown >= kRefreshMs) {
+        m_shown = now;
+        FrameScheduler::of(this)->invalidate(this);
+    }
+    m_idleTimer.start(kWindowMs);
 }
 
 int FpsCounterWidget::getContentHeight() {
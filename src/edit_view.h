@@ -1,6 +1,10 @@
 #ifndef EDIT_VIEW_H
 #define EDIT_VIEW_H
 
+#include <QElapsedTimer>
+#include <QQueue>
+#include <QTimer>
+#include <QVector>
 #include <QWidget>
 
 #include <memory>
@@ -29,8 +33,10 @@ public:
 
     std::shared_ptr<File> getFile() const;
     void relayoutScrollBar();
+    void restoreScrollOrigin(const QPoint &origin);
+    void saveSnapshot();
     void focusOnEdit();
-    void tick();
+    void tick(qint64 paintNs);
 
 public:
     void updateHandler(const QJsonObject &json);
@@ -47,6 +53,9 @@ public slots:
     void scrollBarVChanged(int y);
     void scrollBarHChanged(int x);
     void scrollTester();
+    void benchmark();
+    void toggleOpenGL();
+    void toggleRenderThread();
 
 private:
     EditWindow *m_editWindow;
@@ -74,23 +83,35 @@ public:
         Down,
     };
 
+    // timer ticks per phase: full repaints first, then blitted scrolling
+    static constexpr int kPhaseTicks = 400;
+
     ScrollTester(EditView *view);
     ~ScrollTester();
     void mode();
     void update();
+    void frame(qint64 paintNs);
 
 private:
+    void report(const QString &phase);
+
     State m_state = NotRunning;
     Direction m_direction = Up;
     std::unique_ptr<QTimer> m_timer;
     EditView *m_view = nullptr;
+    int m_ticks = 0;
+    bool m_blittingWasEnabled = true;
+    QVector<qint64> m_frameTimes;
 };
 
+// Frames painted in the last second. Repaints along with the frames it counts,
+// and once more when they stop.
 class FpsCounterWidget : public QWidget {
 public:
-    FpsCounterWidget(QWidget *parent = nullptr);
+    static constexpr int kWindowMs = 1000;
+    static constexpr int kRefreshMs = 100;
 
-    void update();
+    FpsCounterWidget(QWidget *parent = nullptr);
 
     virtual void paintEvent(QPaintEvent *event) override;
     virtual void resizeEvent(QResizeEvent *event) override;
@@ -101,12 +122,12 @@ public:
     int getAverageCharWidth();
 
 private:
-    qint64 m_current = 0;
-    qint64 m_tick = 0;
-    qint64 m_tickCache = 0;
-    int m_fpsCache = 0;
-    bool m_update = false;
-    std::unique_ptr<QTimer> m_timer;
+    void expire();
+
+    QElapsedTimer m_clock;
+    QQueue<qint64> m_frames; // ms timestamps within kWindowMs
+    qint64 m_shown = -kRefreshMs;
+    QTimer m_idleTimer;
     EditView *m_view = nullptr;
     std::unique_ptr<QFontMetrics> m_metrics;
 };
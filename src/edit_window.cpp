@@ -65,6 +65,7 @@ void EditWindow::openFile() {
 void EditWindow::closeFile(const QString &viewId) {
     auto idx = find(viewId, QString());
     if (idx != -1) {
+        tab(idx)->saveSnapshot();
         removeViewTab(idx);
         m_router.erase(m_router.find(viewId));
         m_connection->sendCloseView(viewId);
@@ -201,6 +202,12 @@ void EditWindow::saveCurrentTab() {
 void EditWindow::saveAllTab() {
 }
 
+void EditWindow::saveAllSnapshots() {
+    for (int i = 0; i < count(); ++i) {
+        tab(i)->saveSnapshot();
+    }
+}
+
 void EditWindow::updateHandler(const QString &viewId, const QJsonObject &update) {
     auto view = dynamic_cast<EditView *>(m_router[viewId]);
     if (view) view->updateHandler(update);
@@ -252,6 +259,7 @@ void EditWindow::themeChangedHandler(const QString &name, const QJsonObject &jso
     QtConcurrent::run(QThreadPool::globalInstance(), [this, name, json]() {
         //qDebug() << "themeChangedHandler";
         Perference::shared()->theme()->locked()->applyUpdate(name, json);
+        Perference::shared()->styleMap()->locked()->themeChanged();
         auto i = this->m_router.constBegin();
         while (i != this->m_router.constEnd()) {
             auto viewId = i.key();
@@ -40,6 +40,7 @@ public:
     void closeCurrentTab();
     void saveCurrentTab();
     void saveAllTab();
+    void saveAllSnapshots();
 
     void setupShortcuts();
     void addShortcut(QString sequence, void(xi::EditWindow::*functionToCall)());
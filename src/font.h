@@ -2,19 +2,30 @@
 #define XIFONT_H
 
 #include <QFont>
+#include <QFontMetricsF>
+
+#include <memory>
 
 namespace xi {
 
 class Font {
 public:
-    Font() { m_baseLine = 0; }
+    Font() {
+        m_baseLine = 0;
+        m_metrics = std::make_shared<QFontMetricsF>(m_font);
+    }
     Font(const QFont &font) {
         m_font = font;
         m_baseLine = 0;
+        m_metrics = std::make_shared<QFontMetricsF>(m_font);
     }
     inline QFont getFont() const {
         return m_font;
     }
+    // shared by every line laid out in this font
+    inline std::shared_ptr<QFontMetricsF> metrics() const {
+        return m_metrics;
+    }
     inline int getBaseLine() const {
         return m_baseLine;
     }
@@ -22,6 +33,7 @@ public:
 private:
     QFont m_font;
     int m_baseLine;
+    std::shared_ptr<QFontMetricsF> m_metrics;
 };
 
 struct FontStyle {
@@ -31,6 +43,11 @@ struct FontStyle {
     bool italic = false;
     int weight = QFont::Normal; // QFont::Normal
     bool fakeItalic = false;
+
+    inline bool operator==(const FontStyle &other) const {
+        return italic == other.italic && weight == other.weight && underline == other.underline &&
+               fakeItalic == other.fakeItalic && size == other.size && family == other.family;
+    }
 };
 
 } // namespace xi
@@ -0,0 +1,138 @@
+#include "frame_renderer.h"
+
+#include <QFontMetricsF>
+#include <QPainter>
+#include <QThread>
+#include <QtConcurrent>
+
+#include <cmath>
+
+namespace xi {
+
+class BandPainter : public TextLineVisitor {
+public:
+    BandPainter(QPainter &painter, const QColor &foreground) : m_painter(painter), m_foreground(foreground) {
+    }
+    void rect(const QRectF &rect, const QColor &color) override {
+        m_painter.fillRect(rect, color);
+    }
+    void glyphs(const QPointF &origin, const QGlyphRun &run, const QColor &color) override {
+        // replayed runs already carry a raw font of this thread
+        m_painter.setPen(color.isValid() ? color : m_foreground);
+        m_painter.drawGlyphRun(origin, run);
+    }
+
+private:
+    QPainter &m_painter;
+    QColor m_foreground;
+};
+
+FrameRenderer::FrameRenderer(QObject *parent) : QObject(parent) {
+    m_thread.setMaxThreadCount(1);
+    m_thread.setExpiryTimeout(-1);
+    connect(&m_watcher, &QFutureWatcher<QImage>::finished, this, &FrameRenderer::finished);
+}
+
+FrameRenderer::~FrameRenderer() {
+    m_pending.reset();
+    m_watcher.waitForFinished();
+}
+
+void FrameRenderer::render(const std::shared_ptr<const ViewportFrame> &frame) {
+    if (isBusy()) {
+        m_pending = frame; // only the latest waiting frame is worth drawing
+        return;
+    }
+    start(frame);
+}
+
+void FrameRenderer::start(const std::shared_ptr<const ViewportFrame> &frame) {
+    m_serial = frame->serial;
+    m_watcher.setFuture(QtConcurrent::run(&m_thread, [frame]() {
+        return rasterize(*frame);
+    }));
+}
+
+void FrameRenderer::finished() {
+    auto image = m_watcher.result();
+    auto serial = m_serial;
+    if (m_pending) {
+        auto next = m_pending;
+        m_pending.reset();
+        start(next);
+    }
+    emit frameReady(serial, image);
+}
+
+QImage FrameRenderer::rasterize(const ViewportFrame &frame, int bands) {
+    QSize pixels(std::ceil(frame.size.width() * frame.dpr), std::ceil(frame.size.height() * frame.dpr));
+    QImage image(pixels, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(frame.dpr);
+    if (image.isNull()) return image;
+
+    if (bands <= 0) {
+        bands = qBound(1, pixels.height() / kMinBandHeight, QThread::idealThreadCount());
+    }
+    QVector<int> bandIxs;
+    for (auto i = 0; i < bands; ++i) {
+        bandIxs.append(i);
+    }
+    auto bandHeight = (pixels.height() + bands - 1) / bands;
+    auto paintBand = [&](int ix) {
+        auto top = ix * bandHeight;
+        auto rows = qMin(bandHeight, pixels.height() - top);
+        if (rows <= 0) return;
+        // shares the scanlines of image, bands never overlap
+        QImage band(image.scanLine(top), pixels.width(), rows, image.bytesPerLine(), image.format());
+        band.setDevicePixelRatio(frame.dpr);
+        QPainter painter(&band);
+        painter.translate(0, -top / frame.dpr);
+        QRectF clip(0, top / frame.dpr, frame.size.width(), rows / frame.dpr);
+        painter.setClipRect(clip);
+        paint(painter, frame, clip);
+    };
+    if (bands == 1) {
+        paintBand(0);
+    } else {
+        QtConcurrent::blockingMap(bandIxs, paintBand);
+    }
+    return image;
+}
+
+// what ContentView::paintLines draws, limited to the rows crossing band
+void FrameRenderer::paint(QPainter &painter, const ViewportFrame &frame, const QRectF &band) {
+    QRectF textRect(frame.gutterWidth, 0, frame.size.width() - frame.gutterWidth, frame.size.height());
+    painter.fillRect(textRect & band, frame.background);
+    painter.save();
+    painter.setClipRect(textRect, Qt::IntersectClip);
+    frame.decorations.drawBehindText(painter);
+    BandPainter visitor(painter, frame.foreground);
+    for (const ViewportFrame::Row &row : frame.rows) {
+        // a row covers one linespace down from its pos
+        if (row.pos.y() + frame.linespace < band.top() || row.pos.y() > band.bottom()) continue;
+        if (!row.clip.isNull()) {
+            painter.save();
+            painter.setClipRect(row.clip, Qt::IntersectClip);
+        }
+        row.line.replay(visitor);
+        if (!row.clip.isNull()) {
+            painter.restore();
+        }
+    }
+    frame.decorations.drawOverText(painter);
+    painter.restore();
+
+    QRectF gutterRect(0, 0, frame.gutterWidth, frame.size.height());
+    if (!gutterRect.intersects(band)) return;
+    painter.fillRect(gutterRect & band, frame.gutter);
+    painter.setFont(frame.font);
+    painter.setPen(frame.foreground);
+    QFontMetricsF metrics(frame.font);
+    for (const ViewportFrame::Number &number : frame.numbers) {
+        if (number.baseline + metrics.descent() < band.top() || number.baseline - metrics.ascent() > band.bottom()) continue;
+        auto text = QString::number(number.number);
+        painter.drawText(QPointF(frame.numbersRight - metrics.width(text), number.baseline), text);
+    }
+}
+
+} // namespace xi
@@ -0,0 +1,86 @@
+#ifndef FRAME_RENDERER_H
+#define FRAME_RENDERER_H
+
+#include <QColor>
+#include <QFont>
+#include <QFutureWatcher>
+#include <QImage>
+#include <QObject>
+#include <QPointF>
+#include <QRectF>
+#include <QSize>
+#include <QThreadPool>
+#include <QVector>
+
+#include <memory>
+
+#include "decoration.h"
+#include "text_line.h"
+
+namespace xi {
+
+// Everything one frame of a ContentView shows, captured on the GUI thread and
+// never changed afterwards, so any thread can draw it. Rows are recorded, not
+// TextLines, which keep building chunks and shaping on the GUI thread.
+struct ViewportFrame {
+    struct Row {
+        RecordedLine line;
+        QPointF pos;  // TextLine::draw position the line was recorded at
+        QRectF clip;  // wrapped rows only
+    };
+    struct Number {
+        qreal baseline;
+        int number;
+    };
+
+    quint64 serial = 0;
+    QSize size;
+    qreal dpr = 1;
+    qreal linespace = 0;
+    int gutterWidth = 0;
+    QColor background;
+    QColor foreground;
+    QColor gutter;
+    QFont font;
+    qreal numbersRight = 0; // right edge of the line numbers
+    QVector<Row> rows;
+    QVector<Number> numbers;
+    DecorationBatch decorations;
+};
+
+// Rasterizes ViewportFrames on a dedicated thread, in parallel horizontal bands
+// for tall frames. A frame submitted while one renders replaces any frame still
+// waiting, finished images come back through frameReady on the GUI thread.
+class FrameRenderer : public QObject {
+    Q_OBJECT
+public:
+    static constexpr int kMinBandHeight = 256; // device pixels
+
+    explicit FrameRenderer(QObject *parent = nullptr);
+    ~FrameRenderer();
+
+    void render(const std::shared_ptr<const ViewportFrame> &frame);
+    inline bool isBusy() const {
+        return m_watcher.isRunning();
+    }
+
+    // synchronous, bands <= 0 picks one per kMinBandHeight up to the core count
+    static QImage rasterize(const ViewportFrame &frame, int bands = 0);
+    static void paint(QPainter &painter, const ViewportFrame &frame, const QRectF &band);
+
+signals:
+    void frameReady(quint64 serial, const QImage &image);
+
+private:
+    void start(const std::shared_ptr<const ViewportFrame> &frame);
+    void finished();
+
+    QThreadPool m_thread; // one thread, frames never queue behind layout work
+    QFutureWatcher<QImage> m_watcher;
+    quint64 m_serial = 0;
+    std::shared_ptr<const ViewportFrame> m_pending;
+};
+
+} // namespace xi
+
+#endif // FRAME_RENDERER_H
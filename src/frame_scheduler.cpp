@@ -0,0 +1,109 @@
+#include "frame_scheduler.h"
+
+#include <QAbstractEventDispatcher>
+#include <QScreen>
+#include <QWindow>
+
+namespace xi {
+
+static constexpr qint64 kDefaultIntervalNs = 1'000'000'000 / 60;
+
+static qint64 s_wakeups = 0;
+
+FrameScheduler::FrameScheduler(QWidget *window) : QObject(window), m_window(window) {
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &FrameScheduler::frame);
+    m_clock.start();
+    m_statsTimer.start();
+
+    static auto counting = false;
+    if (!counting) {
+        counting = true;
+        connect(QAbstractEventDispatcher::instance(), &QAbstractEventDispatcher::awake, []() {
+            ++s_wakeups;
+        });
+    }
+    m_statsWakeups = s_wakeups;
+}
+
+FrameScheduler *FrameScheduler::of(QWidget *widget) {
+    auto window = widget->window();
+    auto scheduler = window->findChild<FrameScheduler *>(QString(), Qt::FindDirectChildrenOnly);
+    if (!scheduler) {
+        scheduler = new FrameScheduler(window);
+    }
+    return scheduler;
+}
+
+qint64 FrameScheduler::wakeups() {
+    return s_wakeups;
+}
+
+void FrameScheduler::invalidate(QWidget *widget) {
+    invalidate(widget, widget->rect());
+}
+
+void FrameScheduler::invalidate(QWidget *widget, const QRect &rect) {
+    if (rect.isEmpty()) return;
+    auto ix = m_widgets.indexOf(widget);
+    if (ix < 0) {
+        m_widgets.append(widget);
+        m_regions.append(rect);
+    } else {
+        m_regions[ix] += rect;
+    }
+    schedule();
+}
+
+void FrameScheduler::requestFrame() {
+    schedule();
+}
+
+qint64 FrameScheduler::frameIntervalNs() const {
+    auto handle = m_window->windowHandle();
+    auto screen = handle ? handle->screen() : nullptr;
+    auto rate = screen ? screen->refreshRate() : 0;
+    return rate >= 1 ? qint64(1'000'000'000 / rate) : kDefaultIntervalNs;
+}
+
+// Qt widgets have no vsync callback, frames start on the refresh grid of the screen
+void FrameScheduler::schedule() {
+    if (m_inFrame || m_timer.isActive()) return;
+    auto interval = frameIntervalNs();
+    auto now = m_clock.nsecsElapsed();
+    auto slot = now / interval;
+    if (slot > m_lastSlot) {
+        m_timer.start(0); // first change since the last refresh, no added latency
+        return;
+    }
+    auto next = (m_lastSlot + 1) * interval;
+    m_timer.start(int((next - now + 999'999) / 1'000'000));
+}
+
+void FrameScheduler::frame() {
+    m_lastSlot = m_clock.nsecsElapsed() / frameIntervalNs();
+    ++m_stats.frames;
+    m_inFrame = true;
+    emit frameStarted();
+    m_inFrame = false;
+
+    auto widgets = std::move(m_widgets);
+    auto regions = std::move(m_regions);
+    m_widgets.clear();
+    m_regions.clear();
+    for (auto i = 0; i < widgets.size(); ++i) {
+        if (widgets[i]) widgets[i]->update(regions[i]);
+    }
+}
+
+FrameScheduler::Stats FrameScheduler::takeStats() {
+    auto stats = m_stats;
+    stats.wakeups = s_wakeups - m_statsWakeups;
+    stats.elapsedMs = m_statsTimer.restart();
+    m_stats = Stats();
+    m_statsWakeups = s_wakeups;
+    return stats;
+}
+
+} // namespace xi
@@ -0,0 +1,68 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QRegion>
+#include <QTimer>
+#include <QVector>
+#include <QWidget>
+
+namespace xi {
+
+// Collects the invalidations of every widget in a top level window and turns
+// them into at most one paint per display refresh. Nothing pending, no timer:
+// an idle window never wakes the process. GUI thread only.
+class FrameScheduler : public QObject {
+    Q_OBJECT
+public:
+    struct Stats {
+        qint64 frames = 0;
+        qint64 wakeups = 0; // event loop wakeups of the whole process
+        qint64 elapsedMs = 0;
+    };
+
+    // the scheduler of widget's window, created on first use
+    static FrameScheduler *of(QWidget *widget);
+
+    // event loop wakeups since start, for idle measurements
+    static qint64 wakeups();
+
+    // widget is repainted on the next frame
+    void invalidate(QWidget *widget);
+    void invalidate(QWidget *widget, const QRect &rect);
+    // a frame without repaints, for work that must happen in step with them
+    void requestFrame();
+
+    // refresh interval of the window's screen
+    qint64 frameIntervalNs() const;
+
+    // counters since the last call
+    Stats takeStats();
+
+signals:
+    // the frame starts, invalidations made here join it
+    void frameStarted();
+
+private:
+    explicit FrameScheduler(QWidget *window);
+
+    void schedule();
+    void frame();
+
+    QWidget *m_window;
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_lastSlot = -1; // refresh slot of the last frame
+    bool m_inFrame = false;
+    QVector<QPointer<QWidget>> m_widgets;
+    QVector<QRegion> m_regions;
+    Stats m_stats;
+    qint64 m_statsWakeups = 0;
+    QElapsedTimer m_statsTimer;
+};
+
+} // namespace xi
+
+#endif // FRAME_SCHEDULER_H
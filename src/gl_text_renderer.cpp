@@ -0,0 +1,331 @@
+#include "gl_text_renderer.h"
+
+#include <QOpenGLContext>
+#include <QPainter>
+#include <QVector2D>
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include "frame_renderer.h"
+#include "glyph_cache.h"
+
+namespace xi {
+
+static constexpr int kWhite = 2; // opaque texels in the top left corner
+static constexpr int kPad = 1;   // blank texels around each mask
+
+static const char *kVertexShader = R"(
+in vec2 corner;
+in vec4 rect;
+in vec4 source;
+in vec4 color;
+uniform vec2 viewport;
+uniform vec2 atlasSize;
+out vec2 uv;
+out vec4 tint;
+void main() {
+    vec2 pos = rect.xy + corner * rect.zw;
+    uv = (source.xy + corner * source.zw) / atlasSize;
+    tint = vec4(color.rgb * color.a, color.a);
+    gl_Position = vec4(pos.x / viewport.x * 2.0 - 1.0, 1.0 - pos.y / viewport.y * 2.0, 0.0, 1.0);
+}
+)";
+
+static const char *kFragmentShader = R"(
+in vec2 uv;
+in vec4 tint;
+uniform sampler2D atlas;
+out vec4 fragColor;
+void main() {
+    fragColor = tint * texture(atlas, uv).r;
+}
+)";
+
+GlGlyphAtlas::GlGlyphAtlas() : m_image(kSize, kSize, QImage::Format_Alpha8) {
+    clear();
+}
+
+void GlGlyphAtlas::clear() {
+    m_image.fill(0);
+    for (auto y = 0; y < kWhite; ++y) {
+        memset(m_image.scanLine(y), 0xff, kWhite);
+    }
+    m_entries.clear();
+    m_shelfX = kWhite + kPad;
+    m_shelfY = 0;
+    m_shelfHeight = kWhite;
+    m_dirtyTop = 0;
+    m_dirtyBottom = kSize;
+    m_full = false;
+}
+
+QString GlGlyphAtlas::keyOf(const QRawFont &font, qreal dpr) {
+    return QString("%1/%2/%3/%4/%5").arg(font.familyName(), font.styleName()).arg(font.pixelSize()).arg(font.weight()).arg(dpr);
+}
+
+const GlGlyphAtlas::Entry *GlGlyphAtlas::glyph(const QRawFont &font, quint32 index, qreal dpr) {
+    auto &entries = m_entries[keyOf(font, dpr)];
+    auto it = entries.constFind(index);
+    if (it != entries.constEnd()) return &it.value();
+    if (m_full) return nullptr;
+
+    QRawFont scaled(font);
+    scaled.setPixelSize(font.pixelSize() * dpr);
+    auto bounds = scaled.boundingRect(index);
+    Entry entry;
+    if (bounds.isEmpty()) {
+        return &entries.insert(index, entry).value();
+    }
+
+    auto left = std::floor(bounds.left());
+    auto top = std::floor(bounds.top());
+    auto width = int(std::ceil(bounds.right()) - left) + 2 * kPad;
+    auto height = int(std::ceil(bounds.bottom()) - top) + 2 * kPad;
+    if (m_shelfX + width > kSize) {
+        m_shelfY += m_shelfHeight;
+        m_shelfX = 0;
+        m_shelfHeight = 0;
+    }
+    if (width > kSize || m_shelfY + height > kSize) {
+        m_full = true;
+        return nullptr;
+    }
+
+    QImage mask(width, height, QImage::Format_ARGB32_Premultiplied);
+    mask.fill(Qt::transparent);
+    {
+        QPainter painter(&mask);
+        painter.setPen(Qt::white);
+        QGlyphRun single;
+        single.setRawFont(scaled);
+        single.setGlyphIndexes({index});
+        single.setPositions({QPointF(0, 0)});
+        painter.drawGlyphRun(QPointF(kPad - left, kPad - top), single);
+    }
+    for (auto y = 0; y < height; ++y) {
+        auto src = reinterpret_cast<const QRgb *>(mask.constScanLine(y));
+        auto dst = m_image.scanLine(m_shelfY + y) + m_shelfX;
+        for (auto x = 0; x < width; ++x) {
+            dst[x] = uchar(qAlpha(src[x]));
+        }
+    }
+
+    entry.source = QRectF(m_shelfX, m_shelfY, width, height);
+    entry.offset = QPointF(left - kPad, top - kPad);
+    m_dirtyTop = qMin(m_dirtyTop, m_shelfY);
+    m_dirtyBottom = qMax(m_dirtyBottom, m_shelfY + height);
+    m_shelfX += width;
+    m_shelfHeight = qMax(m_shelfHeight, height);
+    return &entries.insert(index, entry).value();
+}
+
+QPair<int, int> GlGlyphAtlas::takeDirtyRows() {
+    QPair<int, int> rows(m_dirtyTop, m_dirtyBottom);
+    m_dirtyTop = kSize;
+    m_dirtyBottom = 0;
+    return rows;
+}
+
+GlFrameBuilder::GlFrameBuilder(GlGlyphAtlas &atlas, qreal dpr) : m_atlas(atlas), m_dpr(dpr) {
+}
+
+void GlFrameBuilder::clear() {
+    m_quads.clear();
+    m_overflowed = false;
+}
+
+void GlFrameBuilder::push(QRectF target, QRectF source, const QColor &color) {
+    if (!m_clip.isNull()) {
+        auto clipped = target & m_clip;
+        if (clipped.isEmpty()) return;
+        if (clipped != target) {
+            // crop the atlas source by the same fractions
+            auto sx = source.width() / target.width();
+            auto sy = source.height() / target.height();
+            source = QRectF(source.x() + (clipped.x() - target.x()) * sx, source.y() + (clipped.y() - target.y()) * sy,
+                            clipped.width() * sx, clipped.height() * sy);
+            target = clipped;
+        }
+    }
+    GlQuad quad;
+    quad.x = target.x();
+    quad.y = target.y();
+    quad.w = target.width();
+    quad.h = target.height();
+    quad.u = source.x();
+    quad.v = source.y();
+    quad.uw = source.width();
+    quad.vh = source.height();
+    quad.r = quint8(color.red());
+    quad.g = quint8(color.green());
+    quad.b = quint8(color.blue());
+    quad.a = quint8(color.alpha());
+    m_quads.append(quad);
+}
+
+void GlFrameBuilder::rect(const QRectF &rect, const QColor &color) {
+    if (rect.isEmpty() || !color.isValid()) return;
+    push(QRectF(rect.topLeft() * m_dpr, rect.size() * m_dpr), m_atlas.white(), color);
+}
+
+void GlFrameBuilder::glyphs(const QPointF &origin, const QGlyphRun &run, const QColor &color) {
+    auto font = run.rawFont();
+    auto tint = color.isValid() ? color : m_defaultColor;
+    auto indexes = run.glyphIndexes();
+    auto positions = run.positions();
+    for (auto i = 0; i < indexes.size(); ++i) {
+        auto entry = m_atlas.glyph(font, indexes[i], m_dpr);
+        if (!entry) {
+            m_overflowed = true;
+            return;
+        }
+        if (entry->source.isEmpty()) continue;
+        // whole device pixels, the mask maps 1:1 to the screen
+        auto pos = (origin + positions[i]) * m_dpr;
+        QPointF topLeft(std::round(pos.x()) + entry->offset.x(), std::round(pos.y()) + entry->offset.y());
+        push(QRectF(topLeft, entry->source.size()), entry->source, tint);
+    }
+}
+
+void GlFrameBuilder::addFrame(const ViewportFrame &frame) {
+    QRectF textRect(frame.gutterWidth, 0, frame.size.width() - frame.gutterWidth, frame.size.height());
+    setDefaultColor(frame.foreground);
+    setClip(textRect);
+    frame.decorations.visitBehindText(*this);
+    for (const ViewportFrame::Row &row : frame.rows) {
+        setClip(row.clip.isNull() ? textRect : row.clip & textRect);
+        row.line.replay(*this);
+    }
+    setClip(textRect);
+    frame.decorations.visitOverText(*this);
+
+    setClip(QRectF());
+    rect(QRectF(0, 0, frame.gutterWidth, frame.size.height()), frame.gutter);
+    auto face = GlyphCache::shared()->face(frame.font);
+    if (!face || !face->isValid()) return;
+    QGlyphRun run;
+    run.setRawFont(face->rawFont());
+    for (const ViewportFrame::Number &number : frame.numbers) {
+        auto digits = QString::number(number.number);
+        QVector<quint32> indexes;
+        QVector<QPointF> positions;
+        for (auto i = 0; i < digits.size(); ++i) {
+            indexes.append(face->glyph(digits[i].unicode()));
+            positions.append(QPointF(i * face->advance(), 0));
+        }
+        run.setGlyphIndexes(indexes);
+        run.setPositions(positions);
+        glyphs(QPointF(frame.numbersRight - digits.size() * face->advance(), number.baseline), run, frame.foreground);
+    }
+}
+
+GlTextRenderer::~GlTextRenderer() {
+    // GL objects need the context, release() while it is current
+}
+
+bool GlTextRenderer::initialize() {
+    auto context = QOpenGLContext::currentContext();
+    if (!context) return false;
+    auto format = context->format();
+    auto es = context->isOpenGLES();
+    if (format.version() < (es ? qMakePair(3, 0) : qMakePair(3, 3))) return false;
+    initializeOpenGLFunctions();
+
+    QByteArray header = es ? "#version 300 es\nprecision mediump float;\n" : "#version 330 core\n";
+    if (!m_program.addShaderFromSourceCode(QOpenGLShader::Vertex, header + kVertexShader)) return false;
+    if (!m_program.addShaderFromSourceCode(QOpenGLShader::Fragment, header + kFragmentShader)) return false;
+    if (!m_program.link()) return false;
+
+    m_vao.create();
+    QOpenGLVertexArrayObject::Binder binder(&m_vao);
+
+    static const GLfloat corners[] = {0, 0, 1, 0, 0, 1, 1, 1};
+    m_corners.create();
+    m_corners.bind();
+    m_corners.allocate(corners, sizeof(corners));
+    auto corner = m_program.attributeLocation("corner");
+    glEnableVertexAttribArray(corner);
+    glVertexAttribPointer(corner, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+    m_instances = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_instances.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    m_instances.create();
+    m_instances.bind();
+    auto attribute = [&](const char *name, int size, GLenum type, bool normalized, size_t offset) {
+        auto location = m_program.attributeLocation(name);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, size, type, normalized, sizeof(GlQuad), reinterpret_cast<const void *>(offset));
+        glVertexAttribDivisor(location, 1);
+    };
+    attribute("rect", 4, GL_FLOAT, false, offsetof(GlQuad, x));
+    attribute("source", 4, GL_FLOAT, false, offsetof(GlQuad, u));
+    attribute("color", 4, GL_UNSIGNED_BYTE, true, offsetof(GlQuad, r));
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, GlGlyphAtlas::kSize, GlGlyphAtlas::kSize, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+
+    m_valid = true;
+    return true;
+}
+
+void GlTextRenderer::release() {
+    if (m_texture) {
+        glDeleteTextures(1, &m_texture);
+        m_texture = 0;
+    }
+    m_instances.destroy();
+    m_corners.destroy();
+    m_vao.destroy();
+    m_program.removeAllShaders();
+    m_valid = false;
+}
+
+// only the rows that gained glyphs, the whole atlas just once
+void GlTextRenderer::upload(GlGlyphAtlas &atlas) {
+    auto rows = atlas.takeDirtyRows();
+    if (rows.first >= rows.second) return;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rows.first, GlGlyphAtlas::kSize, rows.second - rows.first, GL_RED, GL_UNSIGNED_BYTE,
+                    atlas.image().constScanLine(rows.first));
+}
+
+void GlTextRenderer::render(const QVector<GlQuad> &quads, const QColor &clear, const QSize &viewport, GlGlyphAtlas &atlas) {
+    glViewport(0, 0, viewport.width(), viewport.height());
+    glClearColor(clear.redF(), clear.greenF(), clear.blueF(), 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (!m_valid || quads.isEmpty()) return;
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // premultiplied
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    upload(atlas);
+
+    m_program.bind();
+    m_program.setUniformValue("viewport", QVector2D(viewport.width(), viewport.height()));
+    m_program.setUniformValue("atlasSize", QVector2D(GlGlyphAtlas::kSize, GlGlyphAtlas::kSize));
+    m_program.setUniformValue("atlas", 0);
+
+    QOpenGLVertexArrayObject::Binder binder(&m_vao);
+    m_instances.bind();
+    auto bytes = int(quads.size() * sizeof(GlQuad));
+    if (quads.size() > m_capacity) {
+        m_capacity = quads.size() * 2;
+        m_instances.allocate(int(m_capacity * sizeof(GlQuad)));
+    }
+    m_instances.write(0, quads.constData(), bytes);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, quads.size());
+    m_instances.release();
+    m_program.release();
+}
+
+} // namespace xi
@@ -0,0 +1,140 @@
+#ifndef GL_TEXT_RENDERER_H
+#define GL_TEXT_RENDERER_H
+
+#include <QColor>
+#include <QHash>
+#include <QImage>
+#include <QOpenGLBuffer>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QRawFont>
+#include <QRectF>
+#include <QVector>
+
+#include "text_line.h"
+
+namespace xi {
+
+struct ViewportFrame;
+
+// One instance of a frame: a solid rect or an atlas glyph, device pixels
+struct GlQuad {
+    float x, y, w, h;
+    float u, v, uw, vh; // atlas texels
+    quint8 r, g, b, a;
+};
+
+// Coverage masks of every glyph drawn so far, all fonts on one alpha texture,
+// packed in shelves. A few texels in the corner stay opaque for solid quads.
+// GUI thread only, QRawFont rasterizes there.
+class GlGlyphAtlas {
+public:
+    static constexpr int kSize = 2048;
+
+    struct Entry {
+        QRectF source;  // texels, empty for blank glyphs
+        QPointF offset; // mask's top left from the glyph origin, device pixels
+    };
+
+    GlGlyphAtlas();
+
+    // nullptr once the atlas is full
+    const Entry *glyph(const QRawFont &font, quint32 index, qreal dpr);
+    inline QRectF white() const {
+        return QRectF(0.5, 0.5, 1, 1);
+    }
+    inline bool isFull() const {
+        return m_full;
+    }
+    void clear();
+
+    inline const QImage &image() const {
+        return m_image;
+    }
+    // rows changed since the last call, empty when the texture is current
+    QPair<int, int> takeDirtyRows();
+
+private:
+    static QString keyOf(const QRawFont &font, qreal dpr);
+
+    QImage m_image; // Format_Alpha8
+    QHash<QString, QHash<quint32, Entry>> m_entries;
+    int m_shelfX = 0;
+    int m_shelfY = 0;
+    int m_shelfHeight = 0;
+    int m_dirtyTop = 0;
+    int m_dirtyBottom = 0;
+    bool m_full = false;
+};
+
+// Turns visited lines into quads, clipped to the current clip rect
+class GlFrameBuilder : public TextLineVisitor {
+public:
+    GlFrameBuilder(GlGlyphAtlas &atlas, qreal dpr);
+
+    inline void setDefaultColor(const QColor &color) {
+        m_defaultColor = color;
+    }
+    // logical pixels, a null rect clips nothing
+    inline void setClip(const QRectF &clip) {
+        m_clip = clip.isNull() ? QRectF() : QRectF(clip.topLeft() * m_dpr, clip.size() * m_dpr);
+    }
+
+    void rect(const QRectF &rect, const QColor &color) override;
+    void glyphs(const QPointF &origin, const QGlyphRun &run, const QColor &color) override;
+    // the whole frame in paint order, GUI thread only
+    void addFrame(const ViewportFrame &frame);
+
+    inline const QVector<GlQuad> &quads() const {
+        return m_quads;
+    }
+    // some glyph didn't fit the atlas
+    inline bool overflowed() const {
+        return m_overflowed;
+    }
+    void clear();
+
+private:
+    void push(QRectF target, QRectF source, const QColor &color);
+
+    GlGlyphAtlas &m_atlas;
+    qreal m_dpr;
+    QColor m_defaultColor;
+    QRectF m_clip;
+    QVector<GlQuad> m_quads;
+    bool m_overflowed = false;
+};
+
+// Draws a frame's quads in order with a single instanced call. Needs a current
+// OpenGL 3.3 or ES 3.0 context.
+class GlTextRenderer : protected QOpenGLExtraFunctions {
+public:
+    ~GlTextRenderer();
+
+    // false when the context can't run the renderer, stay on the raster path
+    bool initialize();
+    // deletes the GL objects, the context must be current
+    void release();
+    inline bool isValid() const {
+        return m_valid;
+    }
+
+    // into the bound framebuffer, viewport in device pixels
+    void render(const QVector<GlQuad> &quads, const QColor &clear, const QSize &viewport, GlGlyphAtlas &atlas);
+
+private:
+    void upload(GlGlyphAtlas &atlas);
+
+    bool m_valid = false;
+    QOpenGLShaderProgram m_program;
+    QOpenGLVertexArrayObject m_vao;
+    QOpenGLBuffer m_corners;
+    QOpenGLBuffer m_instances;
+    GLuint m_texture = 0;
+    int m_capacity = 0; // instances the buffer holds
+};
+
+} // namespace xi
+
+#endif // GL_TEXT_RENDERER_H
@@ -0,0 +1,122 @@
+#include "glyph_atlas.h"
+
+#include <QPaintEngine>
+#include <QVarLengthArray>
+
+#include <cmath>
+
+namespace xi {
+
+static constexpr int kSheetSize = 1024; // device pixels
+
+GlyphAtlas *GlyphAtlas::shared() {
+    static GlyphAtlas atlas;
+    return &atlas;
+}
+
+std::shared_ptr<AtlasSheet> GlyphAtlas::sheet(const std::shared_ptr<MonospaceFace> &face, qreal dpr) {
+    auto &sheet = m_sheets[face.get()];
+    if (sheet && qFuzzyCompare(sheet->dpr, dpr)) return sheet;
+
+    auto rawFont = face->rawFont();
+    auto pad = std::ceil(face->advance() / 2); // room for italic and overhanging glyphs
+    sheet = std::make_shared<AtlasSheet>();
+    sheet->dpr = dpr;
+    sheet->cell = QSizeF(face->advance() + 2 * pad, std::ceil(rawFont.ascent() + rawFont.descent()) + 2 * pad);
+    sheet->origin = QPointF(pad, pad + rawFont.ascent());
+    sheet->image = QImage(kSheetSize, kSheetSize, QImage::Format_ARGB32_Premultiplied);
+    sheet->image.setDevicePixelRatio(dpr);
+    sheet->columns = int(kSheetSize / (sheet->cell.width() * dpr));
+    sheet->capacity = sheet->columns * int(kSheetSize / (sheet->cell.height() * dpr));
+    reset(*sheet);
+    return sheet;
+}
+
+void GlyphAtlas::reset(AtlasSheet &sheet) {
+    sheet.image.fill(Qt::transparent);
+    sheet.slots.clear();
+    sheet.full = false;
+}
+
+GlyphAtlas::Stats GlyphAtlas::takeStats() {
+    QMutexLocker locker(&m_mutex);
+    auto stats = m_stats;
+    m_stats = Stats();
+    return stats;
+}
+
+bool GlyphAtlas::draw(QPainter &painter, const QPointF &baseline, const std::shared_ptr<MonospaceFace> &face, const QGlyphRun &run, const QColor &color) {
+    if (!m_enabled || !face) return false;
+    QMutexLocker locker(&m_mutex);
+    if (!painter.paintEngine() || painter.paintEngine()->type() != QPaintEngine::Raster || painter.transform().type() > QTransform::TxTranslate) {
+        ++m_stats.fallbacks;
+        return false;
+    }
+
+    auto dpr = painter.device()->devicePixelRatioF();
+    auto atlas = sheet(face, dpr);
+    if (atlas->full) {
+        reset(*atlas);
+    }
+    if (atlas->capacity == 0) {
+        ++m_stats.fallbacks;
+        return false;
+    }
+
+    auto glyphs = run.glyphIndexes();
+    auto positions = run.positions();
+    auto space = face->glyph(' ');
+    auto rgba = quint64(color.rgba()) << 32;
+
+    // resolve cells, rasterizing misses in one go
+    QVarLengthArray<int, 256> cells(glyphs.size());
+    std::unique_ptr<QPainter> raster;
+    for (auto i = 0; i < glyphs.size(); ++i) {
+        if (glyphs[i] == space) {
+            cells[i] = -1;
+            continue;
+        }
+        auto key = rgba | glyphs[i];
+        auto it = atlas->slots.constFind(key);
+        if (it != atlas->slots.constEnd()) {
+            cells[i] = it.value();
+            continue;
+        }
+        if (atlas->slots.size() >= atlas->capacity) {
+            atlas->full = true; // start over on the next frame
+            ++m_stats.fallbacks;
+            return false;
+        }
+        if (!raster) {
+            raster = std::make_unique<QPainter>(&atlas->image);
+            raster->setPen(color);
+        }
+        auto slot = atlas->slots.size();
+        QPointF cellPos((slot % atlas->columns) * atlas->cell.width(), (slot / atlas->columns) * atlas->cell.height());
+        QGlyphRun single;
+        single.setRawFont(face->rawFont());
+        single.setGlyphIndexes({glyphs[i]});
+        single.setPositions({QPointF(0, 0)});
+        raster->drawGlyphRun(cellPos + atlas->origin, single);
+        atlas->slots.insert(key, slot);
+        cells[i] = slot;
+    }
+    raster.reset();
+
+    // snap to device pixels so every blit is 1:1
+    auto snap = [dpr](qreal v) { return std::round(v * dpr) / dpr; };
+    auto cellWidth = atlas->cell.width();
+    auto cellHeight = atlas->cell.height();
+    for (auto i = 0; i < glyphs.size(); ++i) {
+        auto slot = cells[i];
+        if (slot < 0) continue;
+        QRectF source((slot % atlas->columns) * cellWidth * dpr, (slot / atlas->columns) * cellHeight * dpr, cellWidth * dpr, cellHeight * dpr);
+        QPointF target = baseline + positions[i] - atlas->origin;
+        painter.drawImage(QRectF(snap(target.x()), snap(target.y()), cellWidth, cellHeight), atlas->image, source);
+    }
+    ++m_stats.runs;
+    m_stats.glyphs += glyphs.size();
+    return true;
+}
+
+} // namespace xi
@@ -0,0 +1,67 @@
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include <QColor>
+#include <QGlyphRun>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QPainter>
+
+#include <memory>
+
+#include "glyph_cache.h"
+
+namespace xi {
+
+// Pre-rasterized, alpha blended glyphs of one monospace face, one cell per
+// (glyph, foreground color). Lines are composited from cells with plain blits.
+struct AtlasSheet {
+    QImage image;
+    qreal dpr = 1;
+    QSizeF cell;   // logical
+    QPointF origin; // baseline inside a cell, logical
+    int columns = 0;
+    int capacity = 0;
+    bool full = false;
+    QHash<quint64, int> slots; // rgba << 32 | glyph
+};
+
+class GlyphAtlas {
+public:
+    struct Stats {
+        qint64 runs = 0;      // composited from cells
+        qint64 glyphs = 0;
+        qint64 fallbacks = 0; // monospace runs the caller had to draw itself
+    };
+
+    static GlyphAtlas *shared();
+
+    inline bool isEnabled() const {
+        return m_enabled;
+    }
+    inline void setEnabled(bool enabled) {
+        m_enabled = enabled;
+    }
+
+    // false when the painter can't composite from the atlas, caller draws the run itself
+    bool draw(QPainter &painter, const QPointF &baseline, const std::shared_ptr<MonospaceFace> &face, const QGlyphRun &run, const QColor &color);
+
+    // counters since the last call
+    Stats takeStats();
+
+private:
+    GlyphAtlas() {}
+
+    std::shared_ptr<AtlasSheet> sheet(const std::shared_ptr<MonospaceFace> &face, qreal dpr);
+    void reset(AtlasSheet &sheet);
+
+    QMutex m_mutex;
+    bool m_enabled = true;
+    Stats m_stats;
+    QHash<const MonospaceFace *, std::shared_ptr<AtlasSheet>> m_sheets;
+};
+
+} // namespace xi
+
+#endif // GLYPH_ATLAS_H
@@ -0,0 +1,67 @@
+#include "glyph_cache.h"
+
+#include <QFontInfo>
+#include <QPointF>
+
+namespace xi {
+
+bool MonospaceFace::isSimple(ushort u) {
+    if (u >= 0x20 && u < 0x7F) return true;                   // ASCII
+    if (u >= 0xA0 && u < 0x0300) return u != 0xAD;            // Latin-1, Latin Extended, IPA
+    if (u >= 0x0370 && u < 0x0483) return true;               // Greek, Cyrillic
+    if (u >= 0x048A && u < kCoverage) return true;            // Cyrillic, Cyrillic Supplement
+    return false;                                             // controls, combining marks, ...
+}
+
+MonospaceFace::MonospaceFace(const QFont &font) {
+    m_glyphs.fill(0, kCoverage);
+    if (!QFontInfo(font).fixedPitch()) return;
+
+    m_rawFont = QRawFont::fromFont(font);
+    if (!m_rawFont.isValid()) return;
+
+    auto integerMetrics = (font.styleStrategy() & QFont::ForceIntegerMetrics) != 0;
+    auto cell = m_rawFont.advancesForGlyphIndexes(m_rawFont.glyphIndexesForString("M"));
+    if (cell.isEmpty() || cell.front().x() <= 0) return;
+    m_advance = integerMetrics ? qRound(cell.front().x()) : cell.front().x();
+
+    QString chars;
+    chars.reserve(kCoverage);
+    for (ushort u = 0; u < kCoverage; ++u) {
+        chars.append(QChar(isSimple(u) ? u : ushort(' ')));
+    }
+    auto glyphs = m_rawFont.glyphIndexesForString(chars);
+    if (glyphs.size() != kCoverage) return;
+    auto advances = m_rawFont.advancesForGlyphIndexes(glyphs);
+
+    for (ushort u = 0; u < kCoverage; ++u) {
+        if (!isSimple(u) || glyphs[u] == 0) continue;
+        auto advance = integerMetrics ? qRound(advances[u].x()) : advances[u].x();
+        if (qFuzzyCompare(advance, m_advance)) { // double width glyphs go through the shaper
+            m_glyphs[u] = glyphs[u];
+        }
+    }
+    m_valid = true;
+}
+
+GlyphCache *GlyphCache::shared() {
+    static GlyphCache cache;
+    return &cache;
+}
+
+std::shared_ptr<MonospaceFace> GlyphCache::face(const QFont &font) {
+    QMutexLocker locker(&m_mutex);
+    auto key = font.key();
+    auto it = m_faces.find(key);
+    if (it != m_faces.end()) return it.value();
+    auto face = std::make_shared<MonospaceFace>(font);
+    m_faces.insert(key, face);
+    return face;
+}
+
+std::shared_ptr<MonospaceFace> GlyphCache::find(const QFont &font) {
+    QMutexLocker locker(&m_mutex);
+    return m_faces.value(font.key());
+}
+
+} // namespace xi
@@ -0,0 +1,64 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <QFont>
+#include <QHash>
+#include <QMutex>
+#include <QRawFont>
+#include <QString>
+#include <QVector>
+
+#include <memory>
+
+namespace xi {
+
+// Glyph indices of a fixed pitch face for simple-script characters, resolved
+// once so lines can be positioned arithmetically without the shaper.
+class MonospaceFace {
+public:
+    // utf16 units below this may have a cached glyph
+    static constexpr ushort kCoverage = 0x0530;
+
+    explicit MonospaceFace(const QFont &font);
+
+    inline bool isValid() const {
+        return m_valid;
+    }
+    inline QRawFont rawFont() const {
+        return m_rawFont;
+    }
+    inline qreal advance() const {
+        return m_advance;
+    }
+    // 0 when the unit needs the shaper or a fallback font
+    inline quint32 glyph(ushort u) const {
+        return u < kCoverage ? m_glyphs[u] : 0;
+    }
+
+    static bool isSimple(ushort u);
+
+private:
+    QRawFont m_rawFont;
+    qreal m_advance = 0;
+    bool m_valid = false;
+    QVector<quint32> m_glyphs;
+};
+
+class GlyphCache {
+public:
+    static GlyphCache *shared();
+
+    std::shared_ptr<MonospaceFace> face(const QFont &font);
+    // nullptr when the face hasn't been created yet
+    std::shared_ptr<MonospaceFace> find(const QFont &font);
+
+private:
+    GlyphCache() {}
+
+    QMutex m_mutex;
+    QHash<QString, std::shared_ptr<MonospaceFace>> m_faces;
+};
+
+} // namespace xi
+
+#endif // GLYPH_CACHE_H
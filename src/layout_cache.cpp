@@ -0,0 +1,81 @@
+#include "layout_cache.h"
+
+#include "text_line.h"
+
+namespace xi {
+
+// find highlights are painted as decorations, so moving them must not relayout
+static std::shared_ptr<StyleSpans> layoutStyles(const std::shared_ptr<StyleSpans> &styles) {
+    if (!styles) return styles;
+    auto ids = styles->styles();
+    auto count = styles->size();
+    auto i = 0;
+    while (i < count && ids[i] != 1) ++i;
+    if (i == count) return styles;
+
+    auto filtered = std::make_shared<StyleSpans>();
+    filtered->reserve(count);
+    for (i = 0; i < count; ++i) {
+        if (ids[i] == 1) continue;
+        filtered->append(styles->start(i), styles->length(i), ids[i]);
+    }
+    return filtered;
+}
+
+LayoutKey::LayoutKey(const QString &text, const std::shared_ptr<StyleSpans> &styles, const QString &font, int shapeRevision)
+    : text(text), styles(layoutStyles(styles)), font(font), shapeRevision(shapeRevision) {
+    hash = qHash(text);
+    hash = this->styles ? this->styles->hash(hash) : hash;
+    hash ^= qHash(font) + uint(shapeRevision) * 31;
+}
+
+bool LayoutKey::operator==(const LayoutKey &other) const {
+    if (hash != other.hash || shapeRevision != other.shapeRevision) return false;
+    if (text != other.text || font != other.font) return false;
+    if (styles == other.styles) return true;
+    if (!styles || !other.styles) return false;
+    return *styles == *other.styles;
+}
+
+LayoutCache::LayoutCache() : m_lines(kMaxBytes) {
+}
+
+LayoutCache *LayoutCache::shared() {
+    static LayoutCache cache;
+    return &cache;
+}
+
+std::shared_ptr<TextLine> LayoutCache::layout(const LayoutKey &key, const std::function<std::shared_ptr<TextLine>()> &build) {
+    if (m_enabled) {
+        QMutexLocker locker(&m_mutex);
+        auto cached = m_lines.object(key);
+        if (cached) {
+            m_stats.hits++;
+            return *cached;
+        }
+    }
+
+    auto line = build();
+    if (!line) return nullptr;
+
+    QMutexLocker locker(&m_mutex);
+    m_stats.built++;
+    if (m_enabled) {
+        m_lines.insert(key, new std::shared_ptr<TextLine>(line), line->memoryCost());
+    }
+    return line;
+}
+
+void LayoutCache::clear() {
+    QMutexLocker locker(&m_mutex);
+    m_lines.clear();
+}
+
+LayoutCache::Stats LayoutCache::takeStats() {
+    QMutexLocker locker(&m_mutex);
+    auto stats = m_stats;
+    m_stats = Stats();
+    return stats;
+}
+
+} // namespace xi
@@ -0,0 +1,73 @@
+#ifndef LAYOUT_CACHE_H
+#define LAYOUT_CACHE_H
+
+#include <QCache>
+#include <QMutex>
+#include <QString>
+
+#include <functional>
+#include <memory>
+
+#include "style_span.h"
+
+namespace xi {
+
+class TextLine;
+
+// Everything a TextLine is shaped from. Line objects come and go with every
+// update, undo and restyle while their layouts stay the same. Colors are not
+// part of it, lines are recolored through the StyleTable's palette when drawn.
+struct LayoutKey {
+    LayoutKey(const QString &text, const std::shared_ptr<StyleSpans> &styles, const QString &font, int shapeRevision);
+
+    QString text;
+    std::shared_ptr<StyleSpans> styles; // compared by content
+    QString font;                       // QFont::key()
+    int shapeRevision;                  // StyleTable::shapeRevision()
+    uint hash;
+
+    bool operator==(const LayoutKey &other) const;
+};
+
+inline uint qHash(const LayoutKey &key, uint seed = 0) {
+    return key.hash ^ seed;
+}
+
+// Memory bounded LRU of laid out lines shared by every view
+class LayoutCache {
+public:
+    struct Stats {
+        qint64 hits = 0;
+        qint64 built = 0;
+    };
+
+    static constexpr int kMaxBytes = 64 * 1024 * 1024;
+
+    static LayoutCache *shared();
+
+    inline bool isEnabled() const {
+        return m_enabled;
+    }
+    inline void setEnabled(bool enabled) {
+        m_enabled = enabled;
+    }
+
+    // cached layout, or the result of build (kept unless nullptr)
+    std::shared_ptr<TextLine> layout(const LayoutKey &key, const std::function<std::shared_ptr<TextLine>()> &build);
+
+    void clear();
+    // counters since the last call
+    Stats takeStats();
+
+private:
+    LayoutCache();
+
+    QMutex m_mutex;
+    bool m_enabled = true;
+    QCache<LayoutKey, std::shared_ptr<TextLine>> m_lines;
+    Stats m_stats;
+};
+
+} // namespace xi
+
+#endif // LAYOUT_CACHE_H
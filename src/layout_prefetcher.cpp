@@ -0,0 +1,114 @@
+#include "layout_prefetcher.h"
+
+#include <QMutex>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include "glyph_cache.h"
+#include "layout_cache.h"
+#include "text_line.h"
+
+namespace xi {
+
+struct PrefetchBatch {
+    CacheLines lines;
+    LayoutInputs inputs;
+    int serial = 0;
+    int generation = 0;
+};
+
+// shared with the worker, which may outlive the prefetcher
+struct PrefetchQueue {
+    QMutex mutex;
+    bool running = false;  // a worker is draining the queue
+    bool hasBatch = false; // only the newest request waits
+    PrefetchBatch batch;
+};
+
+static void layoutBatch(const std::shared_ptr<LineCache> &lines, const PrefetchBatch &batch, const QAtomicInt &current) {
+    auto fontKey = batch.inputs.font->getFont().key();
+    for (auto start = 0; start < batch.lines.size(); start += LayoutPrefetcher::kChunkLines) {
+        // superseded, or the layouts were dropped since the request
+        if (current.load() != batch.serial || lines->locked()->layoutGeneration() != batch.generation) return;
+        auto end = qMin(start + LayoutPrefetcher::kChunkLines, batch.lines.size());
+        for (auto i = start; i < end; ++i) {
+            if (current.load() != batch.serial) return;
+            const auto &line = batch.lines[i];
+            auto styles = batch.inputs.styleMap->table();
+            LayoutKey key(line->getText(), line->getStyles(), fontKey, styles->shapeRevision());
+            auto textLine = LayoutCache::shared()->layout(key, [&]() {
+                TextLineBuilder builder(line->offsets(), batch.inputs.font);
+                builder.setFgColor(batch.inputs.foreground);
+                styles->applyStyles(builder, line->getStyles(), batch.inputs.selection);
+                return builder.buildCached();
+            });
+            if (textLine) {
+                lines->locked()->attachAssoc(line, textLine, batch.generation);
+            }
+        }
+    }
+}
+
+LayoutPrefetcher::LayoutPrefetcher(std::shared_ptr<LineCache> lines) {
+    m_lines = lines;
+    m_serial = std::make_shared<QAtomicInt>(0);
+    m_queue = std::make_shared<PrefetchQueue>();
+}
+
+LayoutPrefetcher::~LayoutPrefetcher() {
+    cancel();
+}
+
+void LayoutPrefetcher::cancel() {
+    m_serial->fetchAndAddOrdered(1);
+    QMutexLocker locker(&m_queue->mutex);
+    m_queue->hasBatch = false;
+    m_queue->batch = PrefetchBatch();
+}
+
+void LayoutPrefetcher::prefetch(const RangeI &range, const LayoutInputs &inputs) {
+    PrefetchBatch batch;
+    batch.serial = m_serial->fetchAndAddOrdered(1) + 1;
+    batch.inputs = inputs;
+
+    // workers only reuse font engines created here, see TextLineBuilder::buildCached
+    GlyphCache::shared()->face(inputs.font->getFont());
+
+    {
+        auto lineCache = m_lines->locked();
+        batch.generation = lineCache->layoutGeneration();
+        foreach (const std::shared_ptr<Line> &line, lineCache->linesForRange(range)) {
+            if (line && !line->assoc()) batch.lines.append(line);
+        }
+    }
+
+    {
+        QMutexLocker locker(&m_queue->mutex);
+        m_queue->hasBatch = !batch.lines.isEmpty();
+        m_queue->batch = m_queue->hasBatch ? std::move(batch) : PrefetchBatch();
+        if (m_queue->running || !m_queue->hasBatch) return;
+        m_queue->running = true;
+    }
+
+    auto lines = m_lines;
+    auto queue = m_queue;
+    auto current = m_serial;
+    QtConcurrent::run(QThreadPool::globalInstance(), [lines, queue, current]() {
+        while (true) {
+            PrefetchBatch next;
+            {
+                QMutexLocker locker(&queue->mutex);
+                if (!queue->hasBatch) {
+                    queue->running = false;
+                    return;
+                }
+                next = std::move(queue->batch);
+                queue->batch = PrefetchBatch();
+                queue->hasBatch = false;
+            }
+            layoutBatch(lines, next, *current);
+        }
+    });
+}
+
+} // namespace xi
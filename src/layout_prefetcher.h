@@ -0,0 +1,47 @@
+#ifndef LAYOUT_PREFETCHER_H
+#define LAYOUT_PREFETCHER_H
+
+#include <QAtomicInt>
+#include <QColor>
+
+#include <memory>
+
+#include "font.h"
+#include "line_cache.h"
+#include "range.h"
+#include "style_map.h"
+
+namespace xi {
+
+// What paint would use to build a line, captured on the GUI thread
+struct LayoutInputs {
+    std::shared_ptr<Font> font;
+    std::shared_ptr<StyleMap> styleMap;
+    QColor foreground;
+    QColor selection;
+};
+
+struct PrefetchQueue;
+
+// Lays out the lines around the viewport on a worker thread, so paint only draws.
+// One batch per view is in flight, requests made meanwhile replace the queued one.
+class LayoutPrefetcher {
+public:
+    static constexpr int kChunkLines = 32;
+
+    explicit LayoutPrefetcher(std::shared_ptr<LineCache> lines);
+    ~LayoutPrefetcher();
+
+    // supersedes the previous request
+    void prefetch(const RangeI &range, const LayoutInputs &inputs);
+    void cancel();
+
+private:
+    std::shared_ptr<LineCache> m_lines;
+    std::shared_ptr<QAtomicInt> m_serial;
+    std::shared_ptr<PrefetchQueue> m_queue;
+};
+
+} // namespace xi
+
+#endif // LAYOUT_PREFETCHER_H
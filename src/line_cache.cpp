@@ -4,6 +4,9 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
 
 #include "core_connection.h"
 
@@ -20,13 +23,129 @@ enum class Op {
     unknown,
 };
 
+// ops with fewer lines are decoded inline on the calling thread
+static constexpr int kDecodeChunkLines = 512;
+static constexpr int kParallelDecodeLines = 2 * kDecodeChunkLines;
+
+struct LineDecodeTask {
+    int slot;                   // index into the new line list
+    std::shared_ptr<Line> base; // line being updated, null for ins
+    bool update;
+    QJsonObject json;
+    std::shared_ptr<Line> line; // null while core hasn't sent the text
+};
+
+static void decodeRange(LineDecodeTask *tasks, int begin, int end) {
+    for (auto i = begin; i < end; ++i) {
+        auto &task = tasks[i];
+        if (task.base) {
+            task.line = std::make_shared<Line>(task.base, task.json);
+        } else if (!task.update && task.json["text"].isString()) {
+            task.line = std::make_shared<Line>(task.json);
+        } else {
+            // an update of a line we never had carries no text, it stays invalid
+            task.line = nullptr;
+        }
+    }
+}
+
+// Decode in fixed size chunks pulled from a shared counter, the calling thread takes part
+static void decodeLines(QVector<LineDecodeTask> &tasks, int threads) {
+    auto count = tasks.size();
+    auto data = tasks.data();
+    if (threads <= 0) {
+        threads = QThread::idealThreadCount();
+    }
+    if (count < kParallelDecodeLines || threads <= 1) {
+        decodeRange(data, 0, count);
+        return;
+    }
+
+    auto chunks = (count + kDecodeChunkLines - 1) / kDecodeChunkLines;
+    QAtomicInt next(0);
+    auto worker = [&next, data, count, chunks]() {
+        int chunk;
+        while ((chunk = next.fetchAndAddRelaxed(1)) < chunks) {
+            auto begin = chunk * kDecodeChunkLines;
+            decodeRange(data, begin, qMin(begin + kDecodeChunkLines, count));
+        }
+    };
+    QVector<QFuture<void>> helpers;
+    for (auto i = 1; i < qMin(threads, chunks); ++i) {
+        helpers.append(QtConcurrent::run(QThreadPool::globalInstance(), worker));
+    }
+    worker();
+    for (auto &helper : helpers) {
+        helper.waitForFinished();
+    }
+}
+
+// two updates in a row as one: second copies from indexes first produced
+static QVector<LineMove> composeMoves(const QVector<LineMove> &first, const QVector<LineMove> &second) {
+    QVector<LineMove> moves;
+    moves.reserve(first.size() + second.size());
+    auto it = first.cbegin();
+    for (const LineMove &move : second) {
+        if (move.from < 0) {
+            moves.append(move);
+            continue;
+        }
+        // copies only go forward, so does it
+        auto start = move.start;
+        auto from = move.from;
+        auto count = move.count;
+        while (count > 0) {
+            while (it != first.cend() && it->start + it->count <= from) {
+                ++it;
+            }
+            if (it == first.cend()) {
+                moves.append({start, count, -1});
+                break;
+            }
+            auto n = qMin(count, it->start + it->count - from);
+            moves.append({start, n, it->from < 0 ? -1 : it->from + from - it->start});
+            start += n;
+            from += n;
+            count -= n;
+        }
+    }
+    return moves;
+}
+
+static bool isWide(ushort u) {
+    return (u >= 0x1100 && u <= 0x115f) || (u >= 0x2e80 && u <= 0xa4cf) || (u >= 0xac00 && u <= 0xd7a3) ||
+           (u >= 0xf900 && u <= 0xfaff) || (u >= 0xfe30 && u <= 0xfe4f) || (u >= 0xff00 && u <= 0xff60) ||
+           (u >= 0xffe0 && u <= 0xffe6);
+}
+
+// display columns without shaping: one per code point, two for wide east asian ones
+static int columnsOf(const OffsetIndex &offsets) {
+    auto text = offsets.text();
+    auto length = text.length();
+    auto data = text.utf16();
+    while (length > 0 && (data[length - 1] == '\n' || data[length - 1] == '\r')) {
+        --length;
+    }
+    if (offsets.isAscii()) return length;
+
+    auto columns = 0;
+    for (auto i = 0; i < length; ++i) {
+        auto u = data[i];
+        if (QChar::isLowSurrogate(u) || QChar(u).isMark()) continue;
+        columns += QChar::isHighSurrogate(u) || isWide(u) ? 2 : 1;
+    }
+    return columns;
+}
+
 Line::Line(const QJsonObject &json) {
     m_assoc = nullptr;
-    m_styles = std::make_shared<QList<StyleSpan>>();
+    m_styles = std::make_shared<StyleSpans>();
     m_cursor = std::make_shared<QList<int>>();
 
     if (json["text"].isString()) {
         m_text = json["text"].toString();
+        m_offsets = OffsetIndex(m_text);
+        m_columns = columnsOf(m_offsets);
         if (json.contains("cursor")) {
             auto jsonCursors = json["cursor"].toArray();
             for (auto jsonCursor : jsonCursors) {
@@ -35,7 +154,7 @@ Line::Line(const QJsonObject &json) {
         }
         if (json.contains("styles")) {
             auto jsonStyles = json["styles"].toArray();
-            m_styles = StyleSpan::styles(jsonStyles, m_text);
+            m_styles = StyleSpans::fromJson(jsonStyles, m_offsets);
         } else {
             m_styles->clear();
         }
@@ -54,6 +173,8 @@ Line::Line(std::shared_ptr<Line> line, const QJsonObject &json) {
     m_assoc = nullptr;    
     if (!line) { return; }
     m_text = line->m_text;
+    m_offsets = line->m_offsets;
+    m_columns = line->m_columns;
     if (json.contains("cursor")) {
         m_cursor = std::make_shared<QList<int>>();
         auto jsonCursors = json["cursor"].toArray();
@@ -65,7 +186,7 @@ Line::Line(std::shared_ptr<Line> line, const QJsonObject &json) {
     }
     if (json.contains("styles")) {
         auto jsonStyles = json["styles"].toArray();
-        m_styles = StyleSpan::styles(jsonStyles, m_text);
+        m_styles = StyleSpans::fromJson(jsonStyles, m_offsets);
     } else {
         m_styles = line->m_styles;
     }
@@ -81,18 +202,31 @@ Line::Line(std::shared_ptr<Line> line, const QJsonObject &json) {
     }
 }
 
+Line::Line(const QString &text, std::shared_ptr<StyleSpans> styles, int number) {
+    m_assoc = nullptr;
+    m_text = text;
+    m_offsets = OffsetIndex(text);
+    m_columns = columnsOf(m_offsets);
+    m_styles = styles;
+    m_cursor = std::make_shared<QList<int>>();
+    m_number = number;
+}
+
 Line &Line::operator=(const Line &line) {
     if (this != &line) {
         m_text = line.m_text;
+        m_offsets = line.m_offsets;
         m_cursor = line.m_cursor;
         m_styles = line.m_styles;
         m_assoc = line.m_assoc;
         m_number = line.m_number;
+        m_columns = line.m_columns;
+        m_widthRefined = line.m_widthRefined;
     }
     return *this;
 }
 
-InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
+InvalSet LineCacheState::applyUpdate(const QJsonObject &json, int decodeThreads) {
     InvalSet inval;
     if (!json.contains("ops") || !json["ops"].isArray()) {
         return inval;
@@ -103,6 +237,9 @@ InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
     int newInvalidAfter = 0;
     int oldIdx = 0;
     CacheLines newLines;
+    QVector<LineDecodeTask> decodes;
+    QVector<LineMove> moves;
+    auto inPlace = true; // every surviving line keeps its index, widths need point updates only
 
     auto ops = json["ops"].toArray();
     for (auto opRef : ops) {
@@ -110,8 +247,11 @@ InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
         auto opStr = opObj["op"].toString();
         auto op = to_enum(opStr, Op::unknown);
         auto n = opObj["n"].toInt();
+        auto moveStart = newInvalidBefore + newLines.size() + newInvalidAfter;
+        auto moveFrom = op == Op::copy ? oldIdx : -1;
         switch (op) {
         case Op::invalidate: {
+            inPlace = false;
             auto curLine = newInvalidBefore + newLines.size() + newInvalidAfter;
             auto ix = curLine - m_invalidBefore;
             if (ix + n > 0 && ix < m_lines.size()) {
@@ -128,6 +268,7 @@ InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
             }
         } break;
         case Op::ins: {
+            inPlace = false;
             for (int i = 0; i < newInvalidAfter; ++i) {
                 newLines.push_back(nullptr);
             }
@@ -135,7 +276,8 @@ InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
             inval.addRangeN(newInvalidBefore + newLines.count(), n);
             QJsonArray jsonLines = opObj["lines"].toArray();
             for (auto jsonLine : jsonLines) {
-                newLines.push_back(std::make_shared<Line>(jsonLine.toObject()));
+                decodes.push_back({newLines.size(), nullptr, false, jsonLine.toObject(), nullptr});
+                newLines.push_back(nullptr);
             }
         } break;
         case Op::copy:
@@ -150,6 +292,7 @@ InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
                 }
                 oldIdx += nInvalid;
                 nRemaining -= nInvalid;
+                inPlace = false;
             }
             if (nRemaining > 0 && oldIdx < m_invalidBefore + m_lines.size()) {
                 for (int i = 0; i < newInvalidAfter; ++i) {
@@ -161,6 +304,7 @@ InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
                     inval.addRangeN(newInvalidBefore + newLines.count(), nCopy);
                 }
                 auto startIx = oldIdx - m_invalidBefore;
+                if (startIx != newLines.size()) inPlace = false;
                 if (op == Op::copy) {
                     auto ln = opObj["ln"].toInt();
                     auto lineNumber = ln;
@@ -175,13 +319,15 @@ InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
                     QJsonArray jsonLines = opObj["lines"].toArray();
                     auto jsonIx = n - nRemaining;
                     for (auto ix = startIx; ix < startIx + nCopy; ++ix) {
-                        newLines.push_back(std::make_shared<Line>(m_lines[ix], jsonLines[ix].toObject()));
+                        decodes.push_back({newLines.size(), m_lines[ix], true, jsonLines[jsonIx].toObject(), nullptr});
+                        newLines.push_back(nullptr);
                         jsonIx += 1;
                     }
                 }
                 oldIdx += nCopy;
                 nRemaining -= nCopy;
             }
+            if (nRemaining > 0) inPlace = false;
             if (newLines.size() == 0) {
                 newInvalidBefore += nRemaining;
             } else {
@@ -190,18 +336,46 @@ InvalSet LineCacheState::applyUpdate(const QJsonObject &json) {
             oldIdx += nRemaining;
         } break;
         case Op::skip:
+            inPlace = false;
             oldIdx += n;
             break;
         default:
             qDebug() << "unknown op type " << opStr;
             break;
         }
+        auto moveCount = newInvalidBefore + newLines.size() + newInvalidAfter - moveStart;
+        if (moveCount > 0) {
+            moves.append({moveStart, moveCount, moveFrom});
+        }
+    }
+
+    // stitch decoded lines back in op order
+    decodeLines(decodes, decodeThreads);
+    foreach (const LineDecodeTask &task, decodes) {
+        newLines[task.slot] = task.line;
     }
 
+    inPlace = inPlace && newInvalidBefore == m_invalidBefore && newLines.size() == m_lines.size();
     m_invalidBefore = newInvalidBefore;
     m_lines = newLines;
     m_invalidAfter = newInvalidAfter;
     m_revision++;
+    m_moves = m_hasMoves ? composeMoves(m_moves, moves) : moves;
+    m_hasMoves = true;
+
+    if (inPlace) {
+        foreach (const LineDecodeTask &task, decodes) {
+            m_widths.set(task.slot, task.line ? task.line->columns() : 0);
+            m_changed.addRangeN(m_invalidBefore + task.slot, 1);
+        }
+    } else {
+        m_shifted = true;
+        QVector<qreal> widths(m_lines.size(), 0);
+        for (auto i = 0; i < m_lines.size(); ++i) {
+            if (m_lines[i]) widths[i] = m_lines[i]->columns();
+        }
+        m_widths.reset(widths);
+    }
 
     if (height() < oldHeight) {
         inval.addRange(height(), oldHeight);
@@ -11,6 +11,8 @@
 #include <list>
 #include <vector>
 
+#include "max_width_index.h"
+#include "offset_index.h"
 #include "style_map.h"
 #include "unfair_lock.h"
 
@@ -43,19 +45,40 @@ private:
     QList<RangeI> m_ranges;
 };
 
+// a run of lines in the document after an update, copied from an old index
+// or sent (or invalidated) by core
+struct LineMove {
+    int start;
+    int count;
+    int from; // -1 for lines that are new
+};
+
+// what changed since the last LineCacheState::takeChanges
+struct LineChanges {
+    InvalSet changed;        // lines replaced in place
+    bool inPlace = true;     // false when lines moved, appeared or went away
+    int oldHeight = 0;       // height at the last takeChanges
+    QVector<LineMove> moves; // every line of the document in order, when !inPlace
+};
+
 class Line {
 public:
     friend class LineCache;
+    friend class LineCacheState;
     friend class TextLine;
 
     Line(const QJsonObject &object);
     Line(std::shared_ptr<Line> line, const QJsonObject &object);
+    Line(const QString &text, std::shared_ptr<StyleSpans> styles, int number);
 
     Line &operator=(const Line &line);
 
     inline QString getText() const {
         return m_text;
     }
+    inline const OffsetIndex &offsets() const {
+        return m_offsets;
+    }
     inline int utf16Length() const {
         return m_text.length();
     }
@@ -63,7 +86,7 @@ public:
         return utf16Length();
     }
     inline int utf8Length() const {
-        return m_text.toUtf8().length();
+        return m_offsets.utf8Length();
     }
     inline bool containsCursor() const {
         return m_cursor->count() > 0;
@@ -71,10 +94,11 @@ public:
     inline std::shared_ptr<QList<int>> getCursor() const {
         return m_cursor;
     }
-    inline std::shared_ptr<QList<StyleSpan>> getStyles() const {
+    inline std::shared_ptr<StyleSpans> getStyles() const {
         return m_styles;
     }
     inline void setAssoc(std::shared_ptr<TextLine> assoc) {
+        if (assoc != m_assoc) m_widthRefined = false;
         m_assoc = assoc;
     }
     inline std::shared_ptr<TextLine> assoc() const {
@@ -86,13 +110,27 @@ public:
     int number() const {
         return m_number;
     }
+    // width in columns, estimated from the text until a layout refines it
+    inline qreal columns() const {
+        return m_columns;
+    }
+    inline void setColumns(qreal columns) {
+        m_columns = columns;
+    }
+    // columns come from the current assoc's layout
+    inline bool isWidthRefined() const {
+        return m_widthRefined;
+    }
 
 private:
     QString m_text;
+    OffsetIndex m_offsets;
     std::shared_ptr<QList<int>> m_cursor;
-    std::shared_ptr<QList<StyleSpan>> m_styles;
+    std::shared_ptr<StyleSpans> m_styles;
     std::shared_ptr<TextLine> m_assoc;
     int m_number;
+    qreal m_columns = 0;
+    bool m_widthRefined = false;
 };
 
 class LineCacheState : public UnfairLock {
@@ -115,6 +153,11 @@ public:
         return m_revision;
     }
 
+    // bumped whenever every TextLine is dropped
+    inline int layoutGeneration() const {
+        return m_layoutGeneration;
+    }
+
     void setAssoc(int ix, std::shared_ptr<TextLine> assoc) {
         Q_ASSERT(ix >= m_invalidBefore);
         ix -= m_invalidBefore;
@@ -126,6 +169,14 @@ public:
         foreach (std::shared_ptr<Line> line, m_lines) {
             line->setAssoc(nullptr);
         }
+        m_layoutGeneration++;
+    }
+
+    // attach a TextLine laid out elsewhere, unless paint got there first or it is stale
+    bool attachAssoc(const std::shared_ptr<Line> &line, std::shared_ptr<TextLine> assoc, int generation) {
+        if (generation != m_layoutGeneration || line->assoc()) return false;
+        line->setAssoc(assoc);
+        return true;
     }
 
     CacheLines linesForRange(const RangeI &range) {
@@ -156,15 +207,54 @@ public:
         return inval;
     }
 
-    InvalSet applyUpdate(const QJsonObject &json);
+    // decodeThreads <= 0 uses QThread::idealThreadCount()
+    InvalSet applyUpdate(const QJsonObject &json, int decodeThreads = 0);
+
+    // lines replaced in place since the last call, or how every line moved
+    // when indexes over the lines must be spliced
+    LineChanges takeChanges() {
+        LineChanges changes;
+        changes.changed = m_changed;
+        changes.inPlace = !m_shifted;
+        changes.oldHeight = m_takenHeight;
+        changes.moves = m_moves;
+        m_changed = InvalSet();
+        m_shifted = false;
+        m_moves.clear();
+        m_hasMoves = false;
+        m_takenHeight = height();
+        return changes;
+    }
+
+    // widest cached line in columns, O(1). Lines core hasn't sent are not
+    // counted, the range grows as they arrive.
+    inline qreal maxColumns() const {
+        return m_widths.max();
+    }
+    // a real layout of line ix replaces its estimate, once per attached layout
+    void refineWidth(int ix, qreal columns) {
+        ix -= m_invalidBefore;
+        if (ix < 0 || ix >= m_lines.count() || !m_lines[ix]) return;
+        m_lines[ix]->m_widthRefined = true;
+        if (m_lines[ix]->columns() == columns) return;
+        m_lines[ix]->setColumns(columns);
+        m_widths.set(ix, columns);
+    }
 
 private:
     std::unique_ptr<QSemaphore> m_waitingForLines;
     bool m_isWaiting = false;
     int m_revision = 1;
+    int m_layoutGeneration = 0;
     int m_invalidBefore = 0;
     int m_invalidAfter = 0;
     CacheLines m_lines;
+    MaxWidthIndex m_widths; // over m_lines
+    InvalSet m_changed; // for takeChanges
+    bool m_shifted = false;
+    QVector<LineMove> m_moves; // all updates since takeChanges, composed
+    bool m_hasMoves = false;
+    int m_takenHeight = 0;
 };
 
 class LineCacheLocked {
@@ -208,6 +298,26 @@ public:
         m_inner->flushAssoc();
     }
 
+    inline int layoutGeneration() const {
+        return m_inner->layoutGeneration();
+    }
+
+    inline bool attachAssoc(const std::shared_ptr<Line> &line, std::shared_ptr<TextLine> assoc, int generation) {
+        return m_inner->attachAssoc(line, assoc, generation);
+    }
+
+    inline CacheLines linesForRange(const RangeI &range) {
+        return m_inner->linesForRange(range);
+    }
+
+    inline qreal maxColumns() const {
+        return m_inner->maxColumns();
+    }
+
+    inline void refineWidth(int ix, qreal columns) {
+        m_inner->refineWidth(ix, columns);
+    }
+
     CacheLines blockingGet(const RangeI &range) {
         auto lines = m_inner->linesForRange(range);
         auto missingLines = isMissingLines(lines, range);
@@ -242,8 +352,12 @@ public:
         return m_inner->cursorInval();
     }
 
-    InvalSet applyUpdate(const QJsonObject &json) {
-        return m_inner->applyUpdate(json);
+    InvalSet applyUpdate(const QJsonObject &json, int decodeThreads = 0) {
+        return m_inner->applyUpdate(json, decodeThreads);
+    }
+
+    inline LineChanges takeChanges() {
+        return m_inner->takeChanges();
     }
 
 private:
@@ -0,0 +1,36 @@
+#include "max_width_index.h"
+
+#include <algorithm>
+
+namespace xi {
+
+void MaxWidthIndex::reset(const QVector<qreal> &widths) {
+    m_count = widths.size();
+    if (m_count == 0) {
+        m_leaves = 0;
+        m_tree.clear();
+        return;
+    }
+    m_leaves = 1;
+    while (m_leaves < m_count) {
+        m_leaves *= 2;
+    }
+    m_tree.fill(0, m_leaves * 2);
+    std::copy(widths.begin(), widths.end(), m_tree.begin() + m_leaves);
+    for (auto i = m_leaves - 1; i > 0; --i) {
+        m_tree[i] = qMax(m_tree[i * 2], m_tree[i * 2 + 1]);
+    }
+}
+
+void MaxWidthIndex::set(int ix, qreal width) {
+    if (ix < 0 || ix >= m_count) return;
+    auto i = m_leaves + ix;
+    m_tree[i] = width;
+    for (i /= 2; i > 0; i /= 2) {
+        auto max = qMax(m_tree[i * 2], m_tree[i * 2 + 1]);
+        if (m_tree[i] == max) break; // nothing above changes
+        m_tree[i] = max;
+    }
+}
+
+} // namespace xi
@@ -0,0 +1,30 @@
+#ifndef MAX_WIDTH_INDEX_H
+#define MAX_WIDTH_INDEX_H
+
+#include <QVector>
+
+namespace xi {
+
+// Max segment tree over per-line widths. The widest line is always at the
+// root, point updates are O(log n), a rebuild after line shifts is O(n).
+class MaxWidthIndex {
+public:
+    void reset(const QVector<qreal> &widths);
+    void set(int ix, qreal width);
+
+    inline qreal max() const {
+        return m_tree.isEmpty() ? 0 : m_tree[1];
+    }
+    inline int size() const {
+        return m_count;
+    }
+
+private:
+    int m_count = 0;
+    int m_leaves = 0; // power of two, leaf i lives at m_leaves + i
+    QVector<qreal> m_tree;
+};
+
+} // namespace xi
+
+#endif // MAX_WIDTH_INDEX_H
@@ -0,0 +1,123 @@
+#include "offset_index.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define XI_OFFSET_INDEX_SSE2
+#endif
+
+namespace xi {
+
+static inline int utf8Width(ushort u) {
+    if (u < 0x80) return 1;
+    if (u < 0x800) return 2;
+    if ((u & 0xF800) == 0xD800) return 2; // half of a 4 byte surrogate pair
+    return 3;
+}
+
+static bool isAsciiRange(const ushort *data, int length) {
+    auto i = 0;
+#ifdef XI_OFFSET_INDEX_SSE2
+    const auto mask = _mm_set1_epi16(short(0xFF80));
+    auto bits = _mm_setzero_si128();
+    for (; i + 8 <= length; i += 8) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        bits = _mm_or_si128(bits, _mm_and_si128(v, mask));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(bits, _mm_setzero_si128())) != 0xFFFF) return false;
+#endif
+    for (; i < length; ++i) {
+        if (data[i] >= 0x80) return false;
+    }
+    return true;
+}
+
+// UTF-8 length of data[0, length), at most kBlock units
+static int utf8Bytes(const ushort *data, int length) {
+    auto bytes = 0;
+    auto i = 0;
+#ifdef XI_OFFSET_INDEX_SSE2
+    // unsigned 16 bit compares through the signed ones by flipping the sign bit
+    const auto sign = _mm_set1_epi16(short(0x8000));
+    const auto above7F = _mm_set1_epi16(short(0x7F ^ 0x8000));
+    const auto above7FF = _mm_set1_epi16(short(0x7FF ^ 0x8000));
+    const auto surrogateMask = _mm_set1_epi16(short(0xF800));
+    const auto surrogate = _mm_set1_epi16(short(0xD800));
+    const auto ones = _mm_set1_epi16(1);
+    auto sum = _mm_setzero_si128();
+    for (; i + 8 <= length; i += 8) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        auto biased = _mm_xor_si128(v, sign);
+        // compare results are -1, so 1 - ge80 - ge800 + isSurrogate
+        auto width = _mm_sub_epi16(ones, _mm_cmpgt_epi16(biased, above7F));
+        width = _mm_sub_epi16(width, _mm_cmpgt_epi16(biased, above7FF));
+        width = _mm_add_epi16(width, _mm_cmpeq_epi16(_mm_and_si128(v, surrogateMask), surrogate));
+        sum = _mm_add_epi16(sum, width);
+    }
+    sum = _mm_madd_epi16(sum, ones);
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    bytes = _mm_cvtsi128_si32(sum);
+#endif
+    for (; i < length; ++i) {
+        bytes += utf8Width(data[i]);
+    }
+    return bytes;
+}
+
+OffsetIndex::OffsetIndex() {
+}
+
+OffsetIndex::OffsetIndex(const QString &text) : m_text(text) {
+    auto data = text.utf16();
+    auto length = text.length();
+    if (isAsciiRange(data, length)) {
+        m_ascii = true;
+        m_utf8Length = length;
+        return;
+    }
+
+    m_ascii = false;
+    m_checkpoints.reserve(length / kBlock + 1);
+    auto offset = 0;
+    for (auto block = 0; block < length; block += kBlock) {
+        m_checkpoints.append(offset);
+        offset += utf8Bytes(data + block, qMin(kBlock, length - block));
+    }
+    m_utf8Length = offset;
+}
+
+int OffsetIndex::utf8ToUtf16(int ix) const {
+    if (ix <= 0) return 0;
+    if (ix >= m_utf8Length) return m_text.length();
+    if (m_ascii) return ix;
+
+    auto it = std::upper_bound(m_checkpoints.cbegin(), m_checkpoints.cend(), ix);
+    auto block = int(it - m_checkpoints.cbegin()) - 1;
+    auto data = m_text.utf16();
+    auto offset = m_checkpoints[block];
+    auto i = block * kBlock;
+    // an offset inside a multi-byte sequence resolves to the end of that character
+    while (offset < ix) {
+        offset += utf8Width(data[i]);
+        ++i;
+    }
+    return i;
+}
+
+int OffsetIndex::utf16ToUtf8(int ix) const {
+    if (ix <= 0) return 0;
+    if (ix >= m_text.length()) return m_utf8Length;
+    if (m_ascii) return ix;
+
+    auto block = ix / kBlock;
+    auto data = m_text.utf16();
+    auto offset = m_checkpoints[block];
+    for (auto i = block * kBlock; i < ix; ++i) {
+        offset += utf8Width(data[i]);
+    }
+    return offset;
+}
+
+} // namespace xi
@@ -0,0 +1,44 @@
+#ifndef OFFSET_INDEX_H
+#define OFFSET_INDEX_H
+
+#include <QString>
+#include <QVector>
+
+namespace xi {
+
+// UTF-8 <-> UTF-16 offset mapping of one line, built once per text.
+// All-ASCII text maps 1:1 and stores nothing, otherwise the UTF-8 offset of
+// every kBlock-th UTF-16 unit is kept and the rest is scanned within a block.
+class OffsetIndex {
+public:
+    OffsetIndex();
+    explicit OffsetIndex(const QString &text);
+
+    inline QString text() const {
+        return m_text;
+    }
+    inline bool isAscii() const {
+        return m_ascii;
+    }
+    inline int utf8Length() const {
+        return m_utf8Length;
+    }
+    inline int utf16Length() const {
+        return m_text.length();
+    }
+
+    int utf8ToUtf16(int ix) const;
+    int utf16ToUtf8(int ix) const;
+
+private:
+    static constexpr int kBlock = 64;
+
+    QString m_text;
+    bool m_ascii = true;
+    int m_utf8Length = 0;
+    QVector<int> m_checkpoints; // utf8 offset at utf16 index k * kBlock
+};
+
+} // namespace xi
+
+#endif // OFFSET_INDEX_H
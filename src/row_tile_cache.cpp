@@ -0,0 +1,51 @@
+#include "row_tile_cache.h"
+
+#include <cmath>
+
+#include "text_line.h"
+
+namespace xi {
+
+RowTileCache::RowTileCache() : m_tiles(kMaxBytes) {
+}
+
+RowTileCache *RowTileCache::shared() {
+    static RowTileCache cache;
+    return &cache;
+}
+
+bool RowTileCache::draw(QPainter &painter, const std::shared_ptr<TextLine> &line, const QPointF &pos, qreal height, const QColor &background, int themeRevision,
+                        const LinePalette *palette) {
+    if (!m_enabled) return false;
+    auto dpr = painter.device()->devicePixelRatioF();
+    auto width = std::ceil(line->width()) + 2; // room for the last glyph's overhang
+    QSize pixels(int(std::ceil(width * dpr)), int(std::ceil(height * dpr)));
+    if (pixels.width() > kMaxTileWidth * dpr || pixels.isEmpty()) return false;
+
+    RowTileKey key = {line->id(), themeRevision, palette ? palette->revision() : 0, dpr};
+    auto tile = m_tiles.object(key);
+    if (!tile) {
+        tile = new QPixmap(pixels);
+        tile->setDevicePixelRatio(dpr);
+        tile->fill(background);
+        QPainter tilePainter(tile);
+        tilePainter.setPen(painter.pen());
+        tilePainter.setFont(painter.font());
+        line->draw(tilePainter, QPointF(0, 0), palette);
+        tilePainter.end();
+        if (!m_tiles.insert(key, tile, pixels.width() * pixels.height() * 4)) {
+            return false; // larger than the whole budget, already deleted
+        }
+    }
+
+    // whole device pixels, so the blit is 1:1
+    QPointF target(std::round(pos.x() * dpr) / dpr, std::round(pos.y() * dpr) / dpr);
+    painter.drawPixmap(target, *tile);
+    return true;
+}
+
+void RowTileCache::clear() {
+    m_tiles.clear();
+}
+
+} // namespace xi
@@ -0,0 +1,64 @@
+#ifndef ROW_TILE_CACHE_H
+#define ROW_TILE_CACHE_H
+
+#include <QCache>
+#include <QColor>
+#include <QPainter>
+#include <QPixmap>
+#include <QPointF>
+
+#include <memory>
+
+namespace xi {
+
+class LinePalette;
+class TextLine;
+
+struct RowTileKey {
+    quint64 line; // TextLine::id()
+    int themeRevision;
+    int paletteRevision;
+    qreal dpr;
+
+    inline bool operator==(const RowTileKey &other) const {
+        return line == other.line && themeRevision == other.themeRevision && paletteRevision == other.paletteRevision &&
+               qFuzzyCompare(dpr, other.dpr);
+    }
+};
+
+inline uint qHash(const RowTileKey &key, uint seed = 0) {
+    return qHash(key.line, seed) ^ uint(key.themeRevision) * 31 ^ uint(key.paletteRevision) * 17 ^ uint(key.dpr * 100);
+}
+
+// Rendered rows on an opaque background, so scrolling is a sequence of blits.
+// GUI thread only. A row is rendered again once its TextLine is replaced.
+class RowTileCache {
+public:
+    static constexpr int kMaxBytes = 48 * 1024 * 1024;
+    static constexpr int kMaxTileWidth = 4096; // wider rows are drawn directly
+
+    static RowTileCache *shared();
+
+    inline bool isEnabled() const {
+        return m_enabled;
+    }
+    inline void setEnabled(bool enabled) {
+        m_enabled = enabled;
+    }
+
+    // false when the row doesn't fit a tile, caller draws the line itself
+    bool draw(QPainter &painter, const std::shared_ptr<TextLine> &line, const QPointF &pos, qreal height, const QColor &background, int themeRevision,
+              const LinePalette *palette = nullptr);
+
+    void clear();
+
+private:
+    RowTileCache();
+
+    bool m_enabled = true;
+    QCache<RowTileKey, QPixmap> m_tiles;
+};
+
+} // namespace xi
+
+#endif // ROW_TILE_CACHE_H
@@ -0,0 +1,95 @@
+#include "shaping_cache.h"
+
+#include <QElapsedTimer>
+#include <QTextLayout>
+#include <QTextOption>
+
+namespace xi {
+
+ShapingCache::ShapingCache() : m_tokens(kMaxTokens) {
+}
+
+ShapingCache *ShapingCache::shared() {
+    static ShapingCache cache;
+    return &cache;
+}
+
+std::shared_ptr<ShapedToken> ShapingCache::shape(const QString &text, const QFont &font) {
+    QElapsedTimer timer;
+    timer.start();
+
+    QTextOption option;
+    option.setWrapMode(QTextOption::NoWrap);
+    QTextLayout layout(text, font);
+    layout.setTextOption(option);
+    layout.beginLayout();
+    auto line = layout.createLine();
+    line.setLineWidth(1e6);
+    line.setPosition(QPointF(0, 0));
+    layout.endLayout();
+
+    auto token = std::make_shared<ShapedToken>();
+    token->runs = line.glyphRuns();
+    for (auto &run : token->runs) {
+        auto positions = run.positions();
+        for (auto &pos : positions) {
+            pos.ry() -= line.ascent();
+        }
+        run.setPositions(positions);
+    }
+    token->cursorX.resize(text.length() + 1);
+    for (auto i = 0; i <= text.length(); ++i) {
+        token->cursorX[i] = line.cursorToX(i);
+    }
+    token->width = line.horizontalAdvance();
+    token->shapeNs = timer.nsecsElapsed();
+    return token;
+}
+
+std::shared_ptr<const ShapedToken> ShapingCache::token(const QString &text, const QFont &font, const QString &fontKey) {
+    ShapingKey key = {text, fontKey};
+    {
+        QMutexLocker locker(&m_mutex);
+        auto cached = m_tokens.object(key);
+        if (cached) {
+            m_stats.hits++;
+            m_stats.savedNs += (*cached)->shapeNs;
+            return *cached;
+        }
+    }
+
+    // shape outside the lock, a racing miss on the same token is harmless
+    std::shared_ptr<const ShapedToken> token = shape(text, font);
+
+    QMutexLocker locker(&m_mutex);
+    m_stats.misses++;
+    m_stats.shapeNs += token->shapeNs;
+    if (text.length() <= kMaxTokenLength) {
+        m_tokens.insert(key, new std::shared_ptr<const ShapedToken>(token));
+    }
+    return token;
+}
+
+std::shared_ptr<const ShapedToken> ShapingCache::find(const QString &text, const QString &fontKey) {
+    ShapingKey key = {text, fontKey};
+    QMutexLocker locker(&m_mutex);
+    auto cached = m_tokens.object(key);
+    if (!cached) return nullptr;
+    m_stats.hits++;
+    m_stats.savedNs += (*cached)->shapeNs;
+    return *cached;
+}
+
+void ShapingCache::clear() {
+    QMutexLocker locker(&m_mutex);
+    m_tokens.clear();
+}
+
+ShapingCache::Stats ShapingCache::takeStats() {
+    QMutexLocker locker(&m_mutex);
+    auto stats = m_stats;
+    m_stats = Stats();
+    return stats;
+}
+
+} // namespace xi
@@ -0,0 +1,72 @@
+#ifndef SHAPING_CACHE_H
+#define SHAPING_CACHE_H
+
+#include <QCache>
+#include <QFont>
+#include <QGlyphRun>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <memory>
+
+namespace xi {
+
+// One word, run of punctuation or run of spaces, shaped on its own
+struct ShapedToken {
+    QList<QGlyphRun> runs;  // baseline relative, x from the token start
+    QVector<qreal> cursorX; // one per utf16 boundary, text length + 1
+    qreal width = 0;
+    qint64 shapeNs = 0;
+};
+
+struct ShapingKey {
+    QString text;
+    QString font; // QFont::key()
+
+    inline bool operator==(const ShapingKey &other) const {
+        return text == other.text && font == other.font;
+    }
+};
+
+inline uint qHash(const ShapingKey &key, uint seed = 0) {
+    return qHash(key.text, seed) ^ qHash(key.font, seed);
+}
+
+// LRU of shaped tokens shared by every line and view
+class ShapingCache {
+public:
+    struct Stats {
+        qint64 hits = 0;
+        qint64 misses = 0;
+        qint64 shapeNs = 0; // spent shaping misses
+        qint64 savedNs = 0; // shaping time of the tokens that hit
+    };
+
+    static constexpr int kMaxTokens = 32 * 1024;
+    static constexpr int kMaxTokenLength = 64; // longer tokens are shaped but not kept
+
+    static ShapingCache *shared();
+
+    std::shared_ptr<const ShapedToken> token(const QString &text, const QFont &font, const QString &fontKey);
+    // cached tokens only, nullptr on a miss
+    std::shared_ptr<const ShapedToken> find(const QString &text, const QString &fontKey);
+
+    void clear();
+    // counters since the last call
+    Stats takeStats();
+
+private:
+    ShapingCache();
+
+    static std::shared_ptr<ShapedToken> shape(const QString &text, const QFont &font);
+
+    QMutex m_mutex;
+    QCache<ShapingKey, std::shared_ptr<const ShapedToken>> m_tokens;
+    Stats m_stats;
+};
+
+} // namespace xi
+
+#endif // SHAPING_CACHE_H
@@ -0,0 +1,131 @@
+#include "snapshot.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace xi {
+
+static constexpr quint32 SNAPSHOT_MAGIC = 0x78697376; // "xisv"
+static constexpr quint32 SNAPSHOT_VERSION = 1;
+static constexpr const char *SNAPSHOT_DIR = "snapshots";
+static constexpr const char *SNAPSHOT_SUFFIX = ".snap";
+
+ViewSnapshot::ViewSnapshot() {
+    m_styleMap = std::make_shared<StyleMap>();
+}
+
+QString ViewSnapshot::pathFor(const QString &filePath) {
+    QDir dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    auto key = QCryptographicHash::hash(QFileInfo(filePath).absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+    return dir.filePath(QString(SNAPSHOT_DIR) + "/" + key + SNAPSHOT_SUFFIX);
+}
+
+void ViewSnapshot::appendLine(const std::shared_ptr<Line> &line) {
+    m_lines.append(std::make_shared<Line>(line->getText(), line->getStyles(), line->number()));
+}
+
+void ViewSnapshot::appendStyleDefinition(const QJsonObject &json) {
+    m_styleDefinitions.append(json);
+}
+
+bool ViewSnapshot::save(const QString &filePath) const {
+    QFileInfo info(filePath);
+    if (!info.exists()) return false;
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << SNAPSHOT_MAGIC << SNAPSHOT_VERSION;
+    out << info.lastModified().toMSecsSinceEpoch() << info.size();
+    out << m_scrollOrigin << qint32(m_firstLine) << qint32(m_totalLines);
+    out << qint32(m_lines.size());
+    foreach (const std::shared_ptr<Line> &line, m_lines) {
+        auto styles = line->getStyles();
+        out << line->getText() << qint32(line->number()) << qint32(styles->size());
+        for (auto i = 0; i < styles->size(); ++i) {
+            out << qint32(styles->start(i)) << qint32(styles->length(i)) << qint32(styles->style(i));
+        }
+    }
+    out << qint32(m_styleDefinitions.size());
+    foreach (const QJsonObject &json, m_styleDefinitions) {
+        out << QJsonDocument(json).toJson(QJsonDocument::Compact);
+    }
+
+    auto path = pathFor(filePath);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    file.write(qCompress(payload));
+    return file.commit();
+}
+
+std::shared_ptr<ViewSnapshot> ViewSnapshot::load(const QString &filePath) {
+    QFile file(pathFor(filePath));
+    if (!file.open(QIODevice::ReadOnly)) return nullptr;
+
+    auto payload = qUncompress(file.readAll());
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_12);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    in >> magic >> version;
+    if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION) return nullptr;
+
+    // stale if the file changed on disk since the snapshot was taken
+    qint64 modified = 0;
+    qint64 size = 0;
+    in >> modified >> size;
+    QFileInfo info(filePath);
+    if (info.lastModified().toMSecsSinceEpoch() != modified || info.size() != size) return nullptr;
+
+    auto snapshot = std::make_shared<ViewSnapshot>();
+    qint32 firstLine = 0;
+    qint32 totalLines = 0;
+    qint32 lineCount = 0;
+    in >> snapshot->m_scrollOrigin >> firstLine >> totalLines >> lineCount;
+    snapshot->m_firstLine = firstLine;
+    snapshot->m_totalLines = totalLines;
+
+    for (auto i = 0; i < lineCount; ++i) {
+        QString text;
+        qint32 number = 0;
+        qint32 spanCount = 0;
+        in >> text >> number >> spanCount;
+        if (in.status() != QDataStream::Ok) return nullptr;
+        auto styles = std::make_shared<StyleSpans>();
+        for (auto j = 0; j < spanCount; ++j) {
+            qint32 start = 0;
+            qint32 length = 0;
+            qint32 style = 0;
+            in >> start >> length >> style;
+            if (in.status() != QDataStream::Ok) return nullptr;
+            styles->append(start, length, style);
+        }
+        snapshot->m_lines.append(std::make_shared<Line>(text, styles, number));
+    }
+
+    qint32 definitionCount = 0;
+    in >> definitionCount;
+    auto styleMap = snapshot->m_styleMap->locked();
+    for (auto i = 0; i < definitionCount; ++i) {
+        QByteArray bytes;
+        in >> bytes;
+        if (in.status() != QDataStream::Ok) return nullptr;
+        auto json = QJsonDocument::fromJson(bytes).object();
+        snapshot->m_styleDefinitions.append(json);
+        styleMap->defStyle(json);
+    }
+
+    if (snapshot->isEmpty()) return nullptr;
+    return snapshot;
+}
+
+} // namespace xi
@@ -0,0 +1,68 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <QJsonObject>
+#include <QList>
+#include <QPoint>
+#include <QString>
+
+#include <memory>
+
+#include "line_cache.h"
+#include "style_map.h"
+
+namespace xi {
+
+// Viewport of a closed view, painted on reopen until core sends the first update
+class ViewSnapshot {
+public:
+    ViewSnapshot();
+
+    static std::shared_ptr<ViewSnapshot> load(const QString &filePath);
+    bool save(const QString &filePath) const;
+
+    inline QPoint scrollOrigin() const {
+        return m_scrollOrigin;
+    }
+    inline void setScrollOrigin(const QPoint &origin) {
+        m_scrollOrigin = origin;
+    }
+    inline int firstLine() const {
+        return m_firstLine;
+    }
+    inline void setFirstLine(int line) {
+        m_firstLine = line;
+    }
+    inline int totalLines() const {
+        return m_totalLines;
+    }
+    inline void setTotalLines(int lines) {
+        m_totalLines = lines;
+    }
+    inline CacheLines lines() const {
+        return m_lines;
+    }
+    inline bool isEmpty() const {
+        return m_lines.isEmpty();
+    }
+    inline std::shared_ptr<StyleMap> styleMap() const {
+        return m_styleMap;
+    }
+
+    void appendLine(const std::shared_ptr<Line> &line);
+    void appendStyleDefinition(const QJsonObject &json);
+
+private:
+    static QString pathFor(const QString &filePath);
+
+    QPoint m_scrollOrigin;
+    int m_firstLine = 0;
+    int m_totalLines = 0;
+    CacheLines m_lines;
+    QList<QJsonObject> m_styleDefinitions;
+    std::shared_ptr<StyleMap> m_styleMap; // resolved m_styleDefinitions, filled by load
+};
+
+} // namespace xi
+
+#endif // SNAPSHOT_H
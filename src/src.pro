@@ -22,6 +22,9 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Count heap allocations for the allocations/line figures of the F9 benchmark.
+#DEFINES += XI_ALLOC_STATS
+
 
 RC_ICONS += resources/icons/xi-editor.ico
 
@@ -48,7 +51,24 @@ SOURCES += \
     xi.cpp \
     style_span.cpp \
     style.cpp \
-    config.cpp
+    config.cpp \
+    snapshot.cpp \
+    benchmark.cpp \
+    offset_index.cpp \
+    glyph_cache.cpp \
+    glyph_atlas.cpp \
+    shaping_cache.cpp \
+    layout_prefetcher.cpp \
+    layout_cache.cpp \
+    row_tile_cache.cpp \
+    digit_strip.cpp \
+    wrap_index.cpp \
+    max_width_index.cpp \
+    decoration.cpp \
+    frame_scheduler.cpp \
+    gl_text_renderer.cpp \
+    frame_renderer.cpp \
+    caret_overlay.cpp
 
 HEADERS += \
 	base.h \
@@ -72,7 +92,24 @@ HEADERS += \
     xi.h \
     style_span.h \
     style.h \
-    config.h
+    config.h \
+    snapshot.h \
+    benchmark.h \
+    offset_index.h \
+    glyph_cache.h \
+    glyph_atlas.h \
+    shaping_cache.h \
+    layout_prefetcher.h \
+    layout_cache.h \
+    row_tile_cache.h \
+    digit_strip.h \
+    wrap_index.h \
+    max_width_index.h \
+    decoration.h \
+    frame_scheduler.h \
+    gl_text_renderer.h \
+    frame_renderer.h \
+    caret_overlay.h
 
 DISTFILES += \
     resources/icons/xi-editor-app.png \
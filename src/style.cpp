@@ -2,9 +2,20 @@
 
 namespace xi {
 
-int utf8OffsetToUtf16(const QString &text, int ix) {
-    QString utf16 = text.toUtf8().left(ix);
-    return utf16.length();
+Style::Style(const QColor &fgColor,
+             const QColor &bgColor, bool underline, bool italic, int weight) : m_fgColor(fgColor), m_bgColor(bgColor), m_underline(underline) {
+    m_fontStyle.italic = italic;
+    m_fontStyle.underline = underline;
+    m_fontStyle.weight = weight;
+    m_defined = true;
+
+    if (m_fgColor.isValid()) {
+        m_format.setForeground(m_fgColor);
+    }
+    if (italic || weight) {
+        m_format.setFontItalic(italic);
+        m_format.setFontWeight(weight);
+    }
 }
 
 } // namespace xi
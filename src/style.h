@@ -5,6 +5,7 @@
 #include <QJsonObject>
 #include <QString>
 #include <QStringView>
+#include <QTextCharFormat>
 #include <QVector>
 
 #include <memory>
@@ -13,26 +14,51 @@
 
 namespace xi {
 
-int utf8OffsetToUtf16(const QString &text, int ix);
-
 class Style {
-    friend class StyleMapState;
-
 public:
+    Style() {}
     Style(const QColor &fgColor,
-          const QColor &bgColor, bool underline, bool italic, int weight) : 
-        m_fgColor(fgColor), m_bgColor(bgColor), m_underline(underline) {
-        m_fontStyle.italic = italic;
-        m_fontStyle.underline = underline;
-        m_fontStyle.weight = weight;
+          const QColor &bgColor, bool underline, bool italic, int weight);
+
+    inline bool isDefined() const {
+        return m_defined;
+    }
+    inline QColor fgColor() const {
+        return m_fgColor;
+    }
+    inline QColor bgColor() const {
+        return m_bgColor;
+    }
+    inline const FontStyle &fontStyle() const {
+        return m_fontStyle;
+    }
+    inline bool isFakeItalic() const {
+        return m_fakeItalic;
+    }
+    inline bool isUnderline() const {
+        return m_underline;
+    }
+    // wavy underline, drawn instead of the straight one
+    inline bool isSquiggle() const {
+        return m_squiggle;
+    }
+    inline void setSquiggle(bool squiggle) {
+        m_squiggle = squiggle;
+    }
+    // prebuilt, ready for a QTextLayout::FormatRange
+    inline const QTextCharFormat &format() const {
+        return m_format;
     }
 
 private:
     QColor m_fgColor;
     QColor m_bgColor;
     FontStyle m_fontStyle;
+    QTextCharFormat m_format;
     bool m_fakeItalic = false;
-    bool m_underline;
+    bool m_underline = false;
+    bool m_squiggle = false;
+    bool m_defined = false;
 };
 
 } // namespace xi
@@ -1,5 +1,6 @@
 #include "style_map.h"
 
+#include <QAtomicInt>
 #include <QJsonArray>
 #include <QFontMetricsF>
 
@@ -15,16 +16,34 @@ QColor colorFromArgb(quint32 argb) {
         qreal((argb >> 24) & 0xff) * 1.0 / 255);
 }
 
-void StyleMapState::defStyle(const QJsonObject &json) {
-    auto theme = Perference::shared()->theme()->locked();
+static int nextRevision() {
+    static QAtomicInt revision(0);
+    return revision.fetchAndAddOrdered(1) + 1;
+}
+
+StyleMapState::StyleMapState() {
+    auto table = std::make_shared<StyleTable>();
+    table->m_revision = nextRevision();
+    table->m_shapeRevision = table->m_revision;
+    table->m_palette = std::make_shared<LinePalette>(table->m_revision);
+    m_table = table;
+}
+
+// what TextLineBuilder shapes with, everything else is color or decoration.
+// An undefined style shapes like the default one, see applyStyle.
+static bool sameShape(const Style &a, const Style &b) {
+    return a.fontStyle().italic == b.fontStyle().italic && a.fontStyle().weight == b.fontStyle().weight &&
+           a.isFakeItalic() == b.isFakeItalic();
+}
+
+Style StyleMapState::styleFromJson(const QJsonObject &json, const QColor &foreground) {
     QColor fgColor(QColor::Invalid);
     QColor bgColor(QColor::Invalid);
 
-    auto styleId = json["id"].toInt();
     if (json.contains("fg_color")) {
         fgColor = colorFromArgb(json["fg_color"].toVariant().toULongLong());
     } else {
-        fgColor = theme->foreground();
+        fgColor = foreground;
     }
 
     if (json.contains("bg_color")) {
@@ -32,11 +51,14 @@ void StyleMapState::defStyle(const QJsonObject &json) {
     }
 
     auto underline = false;
+    auto squiggle = false;
     auto italic = false;
     auto weight = int(QFont::Normal);
 
     if (json.contains("underline")) {
-        underline = json["underline"].toBool();
+        // true, or "squiggle" for misspellings and diagnostics
+        squiggle = json["underline"].toString() == "squiggle";
+        underline = squiggle || json["underline"].toBool();
     }
     if (json.contains("italic")) {
         italic = json["italic"].toBool();
@@ -48,60 +70,102 @@ void StyleMapState::defStyle(const QJsonObject &json) {
         weight = QFont::Bold;
     }
 
-    auto style = std::make_shared<Style>(fgColor, bgColor, underline, italic, weight);
+    Style style(fgColor, bgColor, underline, italic, weight);
+    style.setSquiggle(squiggle);
+    return style;
+}
 
-    while (m_styles.count() < styleId) {
-        m_styles.append(nullptr);
+void StyleMapState::defStyle(const QJsonObject &json) {
+    auto foreground = Perference::shared()->theme()->snapshot()->color(ThemeKey::foreground);
+    auto styleId = json["id"].toInt();
+    if (styleId < 0) return;
+    m_definitions[styleId] = json;
+
+    // copy on write, painters may still hold the old table
+    auto table = std::make_shared<StyleTable>(*m_table);
+    table->m_revision = nextRevision();
+    if (table->m_styles.size() <= styleId) {
+        table->m_styles.resize(styleId + 1);
     }
-    if (m_styles.count() == styleId) {
-        m_styles.append(style);
-    } else {
-        m_styles[styleId] = style;
+    auto style = styleFromJson(json, foreground);
+    if (!sameShape(table->m_styles[styleId], style)) {
+        table->m_shapeRevision = table->m_revision;
     }
+    table->m_styles[styleId] = style;
+    publish(table);
 }
 
-void StyleMapState::applyStyle(std::shared_ptr<TextLineBuilder> builder, int id, const RangeI &range, const QColor &selColor) {
-    if (id > m_styles.count()) {
+void StyleMapState::themeChanged() {
+    auto foreground = Perference::shared()->theme()->snapshot()->color(ThemeKey::foreground);
+    auto table = std::make_shared<StyleTable>();
+    table->m_revision = nextRevision();
+    table->m_shapeRevision = m_table->m_shapeRevision; // a theme only recolors
+    table->m_styles.resize(m_table->m_styles.size());
+    for (auto it = m_definitions.cbegin(); it != m_definitions.cend(); ++it) {
+        table->m_styles[it.key()] = styleFromJson(it.value(), foreground);
+    }
+    publish(table);
+}
+
+void StyleMapState::publish(const std::shared_ptr<StyleTable> &table) {
+    auto theme = Perference::shared()->theme()->snapshot();
+    auto palette = std::make_shared<LinePalette>(table->m_revision);
+    palette->setColor(LinePalette::kForeground, theme->color(ThemeKey::foreground));
+    palette->setColor(LinePalette::kSelection, theme->color(ThemeKey::selection));
+    for (auto id = 0; id < table->m_styles.size(); ++id) {
+        const auto &style = table->m_styles[id];
+        palette->setColor(LinePalette::styleSlot(id), style.isDefined() ? style.fgColor() : theme->color(ThemeKey::foreground));
+    }
+    table->m_palette = palette;
+    table->m_pendingFormat.setForeground(theme->color(ThemeKey::foreground));
+    std::atomic_store(&m_table, std::shared_ptr<const StyleTable>(table));
+}
+
+void StyleTable::applyStyle(TextLineBuilder &builder, int id, const RangeI &range, const QColor &selColor) const {
+    if (id == 0) {
+        builder.addSelSpan(range, selColor);
+        return;
+    }
+    if (id == 1) return; // find highlight
+    if (id < 0) {
         qWarning() << "stylemap can't resolve" << id;
         return;
     }
-    if (id == 0 || id == 1) {
-        builder->addSelSpan(range, selColor);
-    } else {
-        auto style = m_styles[id];
-        if (!style) return;
-
-        if (style->m_fgColor.isValid()) {
-            builder->addFgSpan(range, style->m_fgColor);
+    if (id >= m_styles.size() || !m_styles[id].isDefined()) {
+        // core defines styles as it highlights, keep the slot so the
+        // definition only recolors the line instead of reshaping it
+        if (m_pendingFormat.hasProperty(QTextFormat::ForegroundBrush)) {
+            builder.addFgSpan(range, m_pendingFormat.foreground().color(), LinePalette::styleSlot(id));
         }
-        builder->addFontSpan(range, style->m_fontStyle);
+        builder.addStyleSpan(range, id, m_pendingFormat);
+        return;
+    }
+    const auto &style = m_styles[id];
 
-        if (style->m_fakeItalic) {
-            builder->addFakeItalicSpan(range);
-        }
-        if (style->m_underline) {
-            builder->addUnderlineSpan(range, UnderlineStyle::single);
-        }
+    if (style.fgColor().isValid()) {
+        builder.addFgSpan(range, style.fgColor(), LinePalette::styleSlot(id));
+    }
+    builder.addFontSpan(range, style.fontStyle());
+    builder.addStyleSpan(range, id, style.format());
+
+    if (style.isFakeItalic()) {
+        builder.addFakeItalicSpan(range);
     }
 }
 
-void StyleMapState::applyStyles(std::shared_ptr<TextLineBuilder> builder, std::shared_ptr<QList<StyleSpan>> styles, const QColor &selColor, const QColor &highlightColor) {
-    foreach (StyleSpan ss, *styles) {
-        QColor color;
-        auto id = ss.style();
-        switch (id) {
-        case 0:
-            color = selColor;
-            break;
-        case 1:
-            color = highlightColor;
-            break;
-        default:
-            color = QColor(QColor::Invalid);
-            break;
-        }
-        applyStyle(builder, id, ss.range(), color);
+void StyleTable::applyStyles(TextLineBuilder &builder, const std::shared_ptr<StyleSpans> &styles, const QColor &selColor) const {
+    auto count = styles->size();
+    auto starts = styles->starts();
+    auto lengths = styles->lengths();
+    auto ids = styles->styles();
+    for (auto i = 0; i < count; ++i) {
+        auto id = ids[i];
+        applyStyle(builder, id, RangeI(starts[i], starts[i] + lengths[i]), id == 0 ? selColor : QColor(QColor::Invalid));
     }
 }
 
+QJsonObject StyleMapState::definition(int id) const {
+    return m_definitions.value(id);
+}
+
 } // namespace xi
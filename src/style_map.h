@@ -3,6 +3,7 @@
 
 #include <QColor>
 #include <QDebug>
+#include <QHash>
 #include <QJsonObject>
 #include <QString>
 #include <QVector>
@@ -19,14 +20,73 @@ namespace xi {
 
 QColor colorFromArgb(quint32 argb);
 
+// Styles by id with their prebuilt formats. Immutable once published, so a
+// painter can hold one and style lines without taking the StyleMapState lock.
+class StyleTable {
+    friend class StyleMapState;
+
+public:
+    // unique across all StyleMapStates, changes with every definition and theme
+    inline int revision() const {
+        return m_revision;
+    }
+    // changes only when lines styled by the table would shape differently,
+    // new colors are picked up through palette() when lines are drawn
+    inline int shapeRevision() const {
+        return m_shapeRevision;
+    }
+    inline std::shared_ptr<const LinePalette> palette() const {
+        return m_palette;
+    }
+    // nullptr for ids that are out of range or were never defined
+    inline const Style *style(int id) const {
+        if (id < 0 || id >= m_styles.size() || !m_styles[id].isDefined()) return nullptr;
+        return &m_styles[id];
+    }
+
+    void applyStyle(TextLineBuilder &builder, int id, const RangeI &range, const QColor &selColor) const;
+    // find highlights (id 1) are decorations drawn at paint time, not part of the layout
+    void applyStyles(TextLineBuilder &builder, const std::shared_ptr<StyleSpans> &styles, const QColor &selColor) const;
+
+private:
+    QVector<Style> m_styles;
+    std::shared_ptr<const LinePalette> m_palette;
+    QTextCharFormat m_pendingFormat; // ids core uses before defining them
+    int m_revision = 0;
+    int m_shapeRevision = 0;
+};
+
 class StyleMapState : public UnfairLock {
 public:
+    StyleMapState();
+
+    inline int revision() const {
+        return m_table->revision();
+    }
+    // the only member readers may call without the lock
+    inline std::shared_ptr<const StyleTable> table() const {
+        return std::atomic_load(&m_table);
+    }
+
     void defStyle(const QJsonObject &json);
-    void applyStyle(std::shared_ptr<TextLineBuilder> builder, int id, const RangeI &range, const QColor &selColor);
-    void applyStyles(std::shared_ptr<TextLineBuilder> builder, std::shared_ptr<QList<StyleSpan>> styles, const QColor &selColor, const QColor &highlightColor);    
+    // styles without fg_color take the theme foreground, rebuild them
+    void themeChanged();
+
+    inline void applyStyle(TextLineBuilder &builder, int id, const RangeI &range, const QColor &selColor) {
+        m_table->applyStyle(builder, id, range, selColor);
+    }
+    inline void applyStyles(TextLineBuilder &builder, const std::shared_ptr<StyleSpans> &styles, const QColor &selColor) {
+        m_table->applyStyles(builder, styles, selColor);
+    }
+
+    QJsonObject definition(int id) const;
 
 private:
-    QList<std::shared_ptr<Style>> m_styles;
+    static Style styleFromJson(const QJsonObject &json, const QColor &foreground);
+    void publish(const std::shared_ptr<StyleTable> &table);
+
+    std::shared_ptr<const StyleTable> m_table; // swapped atomically, written under the lock
+    QHash<int, QJsonObject> m_definitions;
 };
 
 class StyleMapLocked {
@@ -44,14 +104,30 @@ public:
         m_inner->defStyle(json);
     }
 
-    inline void applyStyle(std::shared_ptr<TextLineBuilder> builder, int id, const RangeI &range, const QColor &selColor) {
+    inline void themeChanged() {
+        m_inner->themeChanged();
+    }
+
+    inline std::shared_ptr<const StyleTable> table() const {
+        return m_inner->table();
+    }
+
+    inline int revision() const {
+        return m_inner->revision();
+    }
+
+    inline void applyStyle(TextLineBuilder &builder, int id, const RangeI &range, const QColor &selColor) {
         m_inner->applyStyle(builder, id, range, selColor);
     }
 
-    inline void applyStyles(std::shared_ptr<TextLineBuilder> builder,
-                     std::shared_ptr<QList<StyleSpan>> styles,
-                     const QColor &selColor, const QColor &highlightColor) {
-        m_inner->applyStyles(builder, styles, selColor, highlightColor);
+    inline void applyStyles(TextLineBuilder &builder,
+                     const std::shared_ptr<StyleSpans> &styles,
+                     const QColor &selColor) {
+        m_inner->applyStyles(builder, styles, selColor);
+    }
+
+    inline QJsonObject definition(int id) const {
+        return m_inner->definition(id);
     }
 
 private:
@@ -68,6 +144,11 @@ public:
         return std::make_shared<StyleMapLocked>(m_state);
     }
 
+    // current snapshot, takes no lock
+    inline std::shared_ptr<const StyleTable> table() const {
+        return m_state->table();
+    }
+
 private:
     std::shared_ptr<StyleMapState> m_state;
 };
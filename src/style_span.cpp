@@ -1,33 +1,93 @@
 #include "style_span.h"
-#include "style.h"
 
 #include <QDebug>
+#include <QHash>
 
 namespace xi {
 
-StyleSpan::StyleSpan(StyleIdentifier style, RangeI range) : m_style(style), m_range(range) {
+StyleSpans::StyleSpans() {
 }
 
-StyleSpan::StyleSpan() : m_style(-1) {
+void StyleSpans::reserve(int size) {
+    m_starts.reserve(size);
+    m_lengths.reserve(size);
+    m_styles.reserve(size);
 }
 
-std::shared_ptr<QList<StyleSpan>> StyleSpan::styles(const QJsonArray &json, const QString &text) {
-    auto vss = std::make_shared<QList<StyleSpan>>();
+void StyleSpans::append(int start, int length, StyleIdentifier style) {
+    m_starts.append(start);
+    m_lengths.append(length);
+    m_styles.append(style);
+}
+
+bool StyleSpans::operator==(const StyleSpans &other) const {
+    return m_starts == other.m_starts && m_lengths == other.m_lengths && m_styles == other.m_styles;
+}
+
+uint StyleSpans::hash(uint seed) const {
+    seed = qHashRange(m_starts.begin(), m_starts.end(), seed);
+    seed = qHashRange(m_lengths.begin(), m_lengths.end(), seed);
+    return qHashRange(m_styles.begin(), m_styles.end(), seed);
+}
+
+void StyleSpans::clear() {
+    m_starts.clear();
+    m_lengths.clear();
+    m_styles.clear();
+}
+
+void StyleSpans::mergeAdjacent() {
+    auto count = size();
+    if (count < 2) return;
+
+    auto starts = m_starts.data();
+    auto lengths = m_lengths.data();
+    auto styles = m_styles.data();
+
+    // branch free pass, joins[i] is set when run i continues run i - 1
+    QVector<uchar> joins(count);
+    auto join = joins.data();
+    join[0] = 0;
+    for (auto i = 1; i < count; ++i) {
+        join[i] = (styles[i] == styles[i - 1]) & (starts[i] == starts[i - 1] + lengths[i - 1]);
+    }
+
+    auto out = 0;
+    for (auto i = 1; i < count; ++i) {
+        if (join[i]) {
+            lengths[out] += lengths[i];
+        } else {
+            ++out;
+            starts[out] = starts[i];
+            lengths[out] = lengths[i];
+            styles[out] = styles[i];
+        }
+    }
+    ++out;
+    m_starts.resize(out);
+    m_lengths.resize(out);
+    m_styles.resize(out);
+}
+
+std::shared_ptr<StyleSpans> StyleSpans::fromJson(const QJsonArray &json, const OffsetIndex &offsets) {
+    auto spans = std::make_shared<StyleSpans>();
+    spans->reserve(json.size() / 3);
     auto ix = 0;
-    for (auto i = 0; i < json.size(); i += 3) {
+    for (auto i = 0; i + 2 < json.size(); i += 3) {
         auto start = ix + json.at(i).toInt();
         auto end = start + json.at(i + 1).toInt();
         auto style = json.at(i + 2).toInt();
-        auto startIx = utf8OffsetToUtf16(text, start);
-        auto endIx = utf8OffsetToUtf16(text, end);
+        auto startIx = offsets.utf8ToUtf16(start);
+        auto endIx = offsets.utf8ToUtf16(end);
         if (startIx < 0 || endIx < startIx) {
-            qWarning() << "malformed style array for line: " << text << json;
+            qWarning() << "malformed style array for line: " << offsets.text() << json;
         } else {
-            vss->append(StyleSpan(style, RangeI(startIx, endIx))); //
+            spans->append(startIx, endIx - startIx, style);
         }
         ix = end;
     }
-    return vss;
+    spans->mergeAdjacent();
+    return spans;
 }
 
-} // namespace xi
\ No newline at end of file
+} // namespace xi
@@ -9,31 +9,62 @@
 
 #include <memory>
 
+#include "offset_index.h"
 #include "range.h"
 
 namespace xi {
 
-class StyleSpan {
+// Style runs of one line as parallel start/length/style arrays, utf16 offsets
+class StyleSpans {
 public:
-    friend class TextLine;
-
     using StyleIdentifier = int;
 
-    StyleSpan();
-    StyleSpan(StyleIdentifier style, RangeI range);
+    StyleSpans();
 
-    static std::shared_ptr<QList<StyleSpan>> styles(const QJsonArray &object, const QString &text);
+    static std::shared_ptr<StyleSpans> fromJson(const QJsonArray &json, const OffsetIndex &offsets);
 
-    inline StyleIdentifier style() const {
-        return m_style;
+    inline int size() const {
+        return m_starts.size();
+    }
+    inline bool isEmpty() const {
+        return m_starts.isEmpty();
+    }
+    inline int start(int i) const {
+        return m_starts[i];
+    }
+    inline int length(int i) const {
+        return m_lengths[i];
+    }
+    inline StyleIdentifier style(int i) const {
+        return m_styles[i];
+    }
+    inline RangeI range(int i) const {
+        return RangeI(m_starts[i], m_starts[i] + m_lengths[i]);
     }
-    inline RangeI range() const {
-        return m_range;
+    inline const int *starts() const {
+        return m_starts.constData();
     }
+    inline const int *lengths() const {
+        return m_lengths.constData();
+    }
+    inline const StyleIdentifier *styles() const {
+        return m_styles.constData();
+    }
+
+    bool operator==(const StyleSpans &other) const;
+    uint hash(uint seed = 0) const;
+
+    void reserve(int size);
+    void append(int start, int length, StyleIdentifier style);
+    void clear();
+
+    // merge touching runs that share a style
+    void mergeAdjacent();
 
 private:
-    StyleIdentifier m_style;
-    RangeI m_range;
+    QVector<int> m_starts;
+    QVector<int> m_lengths;
+    QVector<StyleIdentifier> m_styles;
 };
 
 } // namespace xi
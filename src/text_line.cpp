@@ -1,39 +1,617 @@
-#include "perference.h"
 #include "text_line.h"
 
+#include <QAtomicInteger>
+#include <QHash>
+#include <QRawFont>
+#include <QVarLengthArray>
+
+#include <algorithm>
+
+#include "glyph_atlas.h"
+#include "glyph_cache.h"
+#include "perference.h"
+#include "shaping_cache.h"
+
 namespace xi {
 
-TextLine::TextLine(const QString &text, std::shared_ptr<Font> font) {
-    m_text = text;
+void LinePalette::setColor(int slot, const QColor &color) {
+    if (slot < 0) return;
+    if (m_colors.size() <= slot) {
+        m_colors.resize(slot + 1);
+    }
+    m_colors[slot] = color;
+}
+
+TextLine::TextLine(const OffsetIndex &offsets, std::shared_ptr<Font> font) {
+    static QAtomicInteger<quint64> nextId(0);
+    m_id = nextId.fetchAndAddRelaxed(1) + 1;
+    m_text = offsets.text();
+    m_offsets = offsets;
     m_font = font;
     m_width = 0;
-    m_fontMetrics = std::make_unique<QFontMetricsF>(font->getFont());
-    m_layout = std::make_shared<QTextLayout>(text, font->getFont());
+    m_fontMetrics = font->metrics();
     m_selRanges = std::make_shared<QList<SelRange>>();
 }
 
 int TextLine::xToIndex(qreal x) {
+    if (isChunked()) {
+        auto ix = chunkAt(x);
+        auto &line = chunkLine(ix);
+        auto local = line.m_offsets.utf8ToUtf16(line.xToIndex(x - m_chunks[ix].x));
+        return m_offsets.utf16ToUtf8(m_chunks[ix].range.start() + local);
+    }
+    if (!m_layout && !m_cursorX.isEmpty()) {
+        auto idx = int(std::lower_bound(m_cursorX.begin(), m_cursorX.end(), x) - m_cursorX.begin());
+        if (idx > 0 && (idx == m_cursorX.size() || x - m_cursorX[idx - 1] < m_cursorX[idx] - x)) --idx;
+        return m_offsets.utf16ToUtf8(qMin(idx, m_text.length()));
+    }
+    if (!m_layout) {
+        // up to the trailing newline, which has no width
+        auto idx = qBound(0, qRound(x / m_advance), qRound(m_width / m_advance));
+        return m_offsets.utf16ToUtf8(idx);
+    }
     if (m_layout->lineCount() > 0) {
         auto innerLine = m_layout->lineAt(0);
         auto idx = innerLine.xToCursor(x);
-        auto utf8Ix = m_text.mid(0, idx).toUtf8().length();
-        return utf8Ix;
+        return m_offsets.utf16ToUtf8(idx);
     }
     return 0;
 }
 
 qreal TextLine::indexTox(int ix) {
+    if (isChunked()) {
+        auto utf16 = qBound(0, m_offsets.utf8ToUtf16(ix), m_text.length());
+        auto chunkIx = chunkOf(utf16);
+        auto &line = chunkLine(chunkIx);
+        const auto &chunk = m_chunks[chunkIx];
+        return chunk.x + line.indexTox(line.m_offsets.utf16ToUtf8(utf16 - chunk.range.start()));
+    }
+    if (!m_layout && !m_cursorX.isEmpty()) {
+        return m_cursorX[qBound(0, m_offsets.utf8ToUtf16(ix), m_cursorX.size() - 1)];
+    }
+    if (!m_layout) {
+        return m_offsets.utf8ToUtf16(ix) * m_advance;
+    }
     if (m_layout->lineCount() > 0) {
         auto innerLine = m_layout->lineAt(0);
-        auto count = QString(m_text.toUtf8().mid(0, ix)).count();
-        auto x = innerLine.cursorToX(count);
+        auto x = innerLine.cursorToX(m_offsets.utf8ToUtf16(ix));
         return x;
     }
     return 0;
 }
 
+int TextLine::memoryCost() const {
+    constexpr auto kFixed = 512;          // TextLine, metrics, shared pointers
+    constexpr auto kLayoutPerChar = 96;   // QTextLayout glyph, attribute and cluster arrays
+    constexpr auto kGlyphBytes = sizeof(quint32) + sizeof(QPointF);
+    auto cost = kFixed + m_text.length() * int(sizeof(QChar)) + m_cursorX.size() * int(sizeof(qreal));
+    if (m_layout) cost += m_text.length() * kLayoutPerChar;
+    foreach (const ColoredGlyphRun &run, m_glyphRuns) {
+        cost += int(sizeof(ColoredGlyphRun) + run.run.glyphIndexes().size() * kGlyphBytes);
+    }
+    foreach (const TextLineChunk &chunk, m_chunks) {
+        cost += int(sizeof(TextLineChunk));
+        if (chunk.line) cost += chunk.line->memoryCost();
+    }
+    return cost;
+}
+
+int TextLine::chunkAt(qreal x) const {
+    auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), x, [](qreal x, const TextLineChunk &chunk) {
+        return x < chunk.x;
+    });
+    return qMax(0, int(it - m_chunks.begin()) - 1);
+}
+
+int TextLine::chunkOf(int utf16) const {
+    auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), utf16, [](int ix, const TextLineChunk &chunk) {
+        return ix < chunk.range.start();
+    });
+    return qMax(0, int(it - m_chunks.begin()) - 1);
+}
+
+TextLine &TextLine::chunkLine(int ix) {
+    auto &chunk = m_chunks[ix];
+    if (!chunk.line) {
+        chunk.line = m_chunkSource->slice(chunk.range.start(), chunk.range.end())->build(m_chunkDefault);
+        if (!qFuzzyCompare(chunk.width, chunk.line->width())) {
+            // the estimate was off, everything after it moves
+            chunk.width = chunk.line->width();
+            placeChunks(ix + 1);
+        }
+    }
+    return *chunk.line;
+}
+
+void TextLine::placeChunks(int from) {
+    auto x = from > 0 ? m_chunks[from - 1].x + m_chunks[from - 1].width : 0;
+    for (auto i = from; i < m_chunks.size(); ++i) {
+        m_chunks[i].x = x;
+        x += m_chunks[i].width;
+    }
+    m_width = x;
+}
+
+// glyphs of run whose origin x lies in [left, right), runs go left to right
+static QGlyphRun glyphsIn(const QGlyphRun &run, qreal left, qreal right) {
+    auto positions = run.positions();
+    if (positions.isEmpty() || (positions.first().x() >= left && positions.last().x() < right)) return run;
+    auto byX = [](const QPointF &pos, qreal x) {
+        return pos.x() < x;
+    };
+    auto begin = std::lower_bound(positions.cbegin(), positions.cend(), left, byX);
+    auto end = std::lower_bound(begin, positions.cend(), right, byX);
+    auto from = int(begin - positions.cbegin());
+    auto count = int(end - begin);
+    QGlyphRun slice(run);
+    slice.setGlyphIndexes(run.glyphIndexes().mid(from, count));
+    slice.setPositions(positions.mid(from, count));
+    return slice;
+}
+
+void TextLine::draw(QPainter &painter, const QPointF &pos, const LinePalette *palette) {
+    auto view = painter.hasClipping() ? painter.clipBoundingRect() : painter.transform().inverted().mapRect(QRectF(painter.viewport()));
+    auto left = view.left() - pos.x();
+    auto right = view.right() - pos.x();
+    if (isChunked()) {
+        for (auto ix = chunkAt(left); ix < m_chunks.size() && m_chunks[ix].x < right; ++ix) {
+            auto &line = chunkLine(ix);
+            line.draw(painter, QPointF(pos.x() + m_chunks[ix].x, pos.y()), palette);
+        }
+        return;
+    }
+    if (m_layout) {
+        m_layout->draw(&painter, pos, layoutOverrides(palette));
+        return;
+    }
+
+    auto top = pos.y() + m_lineTop;
+    auto height = m_fontMetrics->ascent() + m_fontMetrics->descent();
+    foreach (const BackgroundColorRange &bg, m_backgrounds) {
+        painter.fillRect(QRectF(pos.x() + bg.range.start(), top, bg.range.length(), height), resolveColor(palette, bg.slot, bg.color));
+    }
+
+    // a wrapped row is the whole line clipped, only the glyphs in view are drawn
+    auto pen = painter.pen();
+    QPointF baseline(pos.x(), top + m_fontMetrics->ascent());
+    auto atlas = GlyphAtlas::shared();
+    auto margin = m_fontMetrics->maxWidth();
+    foreach (const ColoredGlyphRun &run, m_glyphRuns) {
+        auto glyphs = glyphsIn(run.run, left - margin, right);
+        if (glyphs.glyphIndexes().isEmpty()) continue;
+        auto color = resolveColor(palette, run.slot, run.color);
+        if (!color.isValid()) color = pen.color();
+        if (atlas->draw(painter, baseline, run.face, glyphs, color)) continue;
+        painter.setPen(color);
+        painter.drawGlyphRun(baseline, glyphs);
+    }
+    painter.setPen(pen);
+}
+
+void TextLine::visit(TextLineVisitor &visitor, const QPointF &pos, qreal left, qreal right, const LinePalette *palette) {
+    if (isChunked()) {
+        for (auto ix = chunkAt(left - pos.x()); ix < m_chunks.size() && m_chunks[ix].x < right - pos.x(); ++ix) {
+            auto &line = chunkLine(ix);
+            line.visit(visitor, QPointF(pos.x() + m_chunks[ix].x, pos.y()), left, right, palette);
+        }
+        return;
+    }
+    if (m_layout) {
+        visitLayout(visitor, pos, palette);
+        return;
+    }
+
+    auto top = pos.y() + m_lineTop;
+    auto height = m_fontMetrics->ascent() + m_fontMetrics->descent();
+    foreach (const BackgroundColorRange &bg, m_backgrounds) {
+        visitor.rect(QRectF(pos.x() + bg.range.start(), top, bg.range.length(), height), resolveColor(palette, bg.slot, bg.color));
+    }
+    QPointF baseline(pos.x(), top + m_fontMetrics->ascent());
+    auto margin = m_fontMetrics->maxWidth();
+    foreach (const ColoredGlyphRun &run, m_glyphRuns) {
+        auto glyphs = glyphsIn(run.run, left - pos.x() - margin, right - pos.x());
+        if (glyphs.glyphIndexes().isEmpty()) continue;
+        visitor.glyphs(baseline, glyphs, resolveColor(palette, run.slot, run.color));
+    }
+}
+
+void RecordedLine::rect(const QRectF &rect, const QColor &color) {
+    m_ops.append({rect, QPointF(), QVector<quint32>(), QVector<QPointF>(), -1, color});
+}
+
+void RecordedLine::glyphs(const QPointF &origin, const QGlyphRun &run, const QColor &color) {
+    auto raw = run.rawFont();
+    FontDescription font = {raw.familyName(), raw.styleName(), raw.pixelSize(), raw.weight(), raw.style()};
+    auto ix = m_fonts.indexOf(font);
+    if (ix < 0) {
+        ix = m_fonts.size();
+        m_fonts.append(font);
+    }
+    m_ops.append({QRectF(), origin, run.glyphIndexes(), run.positions(), ix, color});
+}
+
+void RecordedLine::replay(TextLineVisitor &visitor) const {
+    QVarLengthArray<QRawFont, 4> fonts;
+    for (const FontDescription &font : m_fonts) {
+        fonts.append(localFont(font));
+    }
+    for (const Op &op : m_ops) {
+        if (op.font < 0) {
+            visitor.rect(op.rect, op.color);
+            continue;
+        }
+        QGlyphRun run;
+        run.setRawFont(fonts[op.font]);
+        run.setGlyphIndexes(op.glyphs);
+        run.setPositions(op.positions);
+        visitor.glyphs(op.origin, run, op.color);
+    }
+}
+
+// created and cached by the calling thread from the description alone
+QRawFont RecordedLine::localFont(const FontDescription &font) {
+    thread_local QHash<QString, QRawFont> fonts;
+    auto key = QString("%1/%2/%3/%4/%5").arg(font.family, font.style).arg(font.pixelSize).arg(font.weight).arg(int(font.slant));
+    auto it = fonts.constFind(key);
+    if (it != fonts.constEnd()) return it.value();
+    QFont qfont(font.family);
+    qfont.setStyleName(font.style);
+    qfont.setPixelSize(qMax(1, qRound(font.pixelSize)));
+    qfont.setWeight(font.weight);
+    qfont.setStyle(font.slant);
+    auto local = QRawFont::fromFont(qfont);
+    local.setPixelSize(font.pixelSize);
+    fonts.insert(key, local);
+    return local;
+}
+
+// ranges whose slot changed color since the layout was built, drawn like selections
+QVector<QTextLayout::FormatRange> TextLine::layoutOverrides(const LinePalette *palette) const {
+    QVector<QTextLayout::FormatRange> overrides;
+    if (!palette) return overrides;
+    for (const LayoutColor &layoutColor : m_layoutColors) {
+        auto color = palette->color(layoutColor.color.slot, layoutColor.color.color);
+        if (color == layoutColor.color.color) continue;
+        QTextLayout::FormatRange range;
+        range.start = layoutColor.range.start();
+        range.length = layoutColor.range.length();
+        if (layoutColor.background) {
+            range.format.setBackground(color);
+        } else {
+            range.format.setForeground(color);
+        }
+        overrides.append(range);
+    }
+    return overrides;
+}
+
+// glyph runs carry no color, so the line is split where the foreground changes
+void TextLine::visitLayout(TextLineVisitor &visitor, const QPointF &pos, const LinePalette *palette) const {
+    if (m_layout->lineCount() == 0) return;
+    auto qline = m_layout->lineAt(0);
+    auto length = m_text.length();
+
+    QVarLengthArray<QColor, 8> colors;
+    colors.append(QColor());
+    QVarLengthArray<uchar, 256> colorOf(length);
+    std::fill(colorOf.begin(), colorOf.end(), uchar(0));
+    for (const LayoutColor &layoutColor : m_layoutColors) {
+        auto start = qBound(0, layoutColor.range.start(), length);
+        auto end = qBound(start, layoutColor.range.end(), length);
+        auto color = resolveColor(palette, layoutColor.color.slot, layoutColor.color.color);
+        if (layoutColor.background) {
+            auto x0 = qline.cursorToX(start);
+            auto x1 = qline.cursorToX(end);
+            visitor.rect(QRectF(pos.x() + x0, pos.y() + qline.y(), x1 - x0, qline.height()), color);
+            continue;
+        }
+        auto ix = std::find(colors.begin(), colors.end(), color) - colors.begin();
+        if (ix == colors.size()) {
+            if (ix > 0xff) continue;
+            colors.append(color);
+        }
+        std::fill(colorOf.begin() + start, colorOf.begin() + end, uchar(ix));
+    }
+
+    for (auto start = 0; start < length;) {
+        auto end = start + 1;
+        while (end < length && colorOf[end] == colorOf[start]) ++end;
+        for (const QGlyphRun &run : m_layout->glyphRuns(start, end - start)) {
+            visitor.glyphs(pos, run, colors[colorOf[start]]);
+        }
+        start = end;
+    }
+}
+
+bool TextLineBuilder::resolveColors(bool buildDefault, QVarLengthArray<PaletteColor, 8> &colors, QVarLengthArray<uchar, 256> &colorOf) const {
+    auto length = m_text.length();
+    colors.append(buildDefault ? PaletteColor{m_defaultFgColor, LinePalette::kForeground} : PaletteColor());
+    colorOf.resize(length);
+    std::fill(colorOf.begin(), colorOf.end(), uchar(0));
+    for (const PaletteSpan &span : m_fgSpans) {
+        if (!span.payload.color.isValid()) continue;
+        auto ix = std::find(colors.begin(), colors.end(), span.payload) - colors.begin();
+        if (ix == colors.size()) {
+            if (ix > 0xff) return false;
+            colors.append(span.payload);
+        }
+        auto start = qBound(0, span.range.start(), length);
+        auto end = qBound(start, span.range.end(), length);
+        std::fill(colorOf.begin() + start, colorOf.begin() + end, uchar(ix));
+    }
+    return true;
+}
+
+bool TextLineBuilder::buildMonospace(TextLine &textline, bool buildDefault) {
+    auto font = m_font->getFont();
+    auto face = m_cachedOnly ? GlyphCache::shared()->find(font) : GlyphCache::shared()->face(font);
+    if (!face || !face->isValid()) return false;
+
+    // lines from core end in a newline, it takes no column and has no glyph
+    auto length = m_text.length();
+    auto data = m_text.utf16();
+    while (length > 0 && (data[length - 1] == '\n' || data[length - 1] == '\r')) {
+        --length;
+    }
+    for (auto i = 0; i < length; ++i) {
+        if (!face->glyph(data[i])) return false;
+    }
+
+    // faces[0] is the line font, font spans may add bold/italic variants on the same grid
+    QVarLengthArray<std::shared_ptr<MonospaceFace>, 4> faces;
+    faces.append(face);
+    QVarLengthArray<uchar, 256> faceOf(length);
+    std::fill(faceOf.begin(), faceOf.end(), uchar(0));
+    for (const FontSpan &span : m_fontSpans) {
+        QFont variant(font);
+        variant.setItalic(span.payload.italic);
+        variant.setWeight(span.payload.weight);
+        auto variantFace = m_cachedOnly ? GlyphCache::shared()->find(variant) : GlyphCache::shared()->face(variant);
+        if (!variantFace || !variantFace->isValid() || !qFuzzyCompare(variantFace->advance(), face->advance())) return false;
+        auto start = qBound(0, span.range.start(), length);
+        auto end = qBound(start, span.range.end(), length);
+        for (auto i = start; i < end; ++i) {
+            if (!variantFace->glyph(data[i])) return false;
+        }
+        auto ix = std::find(faces.begin(), faces.end(), variantFace) - faces.begin();
+        if (ix == faces.size()) faces.append(variantFace);
+        std::fill(faceOf.begin() + start, faceOf.begin() + end, uchar(ix));
+    }
+
+    QVarLengthArray<PaletteColor, 8> colors;
+    QVarLengthArray<uchar, 256> colorOf;
+    if (!resolveColors(buildDefault, colors, colorOf)) return false;
+
+    auto advance = face->advance();
+    for (auto i = 0; i < length;) {
+        auto j = i + 1;
+        while (j < length && faceOf[j] == faceOf[i] && colorOf[j] == colorOf[i]) {
+            ++j;
+        }
+        auto runFace = faces[faceOf[i]];
+        QVector<quint32> glyphs(j - i);
+        QVector<QPointF> positions(j - i);
+        for (auto k = i; k < j; ++k) {
+            glyphs[k - i] = runFace->glyph(data[k]);
+            positions[k - i] = QPointF(k * advance, 0);
+        }
+        QGlyphRun run;
+        run.setRawFont(runFace->rawFont());
+        run.setGlyphIndexes(glyphs);
+        run.setPositions(positions);
+        const auto &color = colors[colorOf[i]];
+        ColoredGlyphRun colored = {run, color.color, runFace, color.slot};
+        textline.m_glyphRuns.append(colored);
+        i = j;
+    }
+
+    for (const ColorSpan &span : m_selSpans) {
+        if (span.payload.isValid()) {
+            BackgroundColorRange bg = {RangeF(span.range.start() * advance, span.range.end() * advance), span.payload};
+            textline.m_backgrounds.append(bg);
+        }
+    }
+
+    textline.m_advance = advance;
+    textline.m_lineTop = textline.metrics()->leading();
+    textline.m_width = length * advance;
+    return true;
+}
+
+bool TextLineBuilder::buildShaped(TextLine &textline, bool buildDefault) {
+    auto length = m_text.length();
+    auto data = m_text.utf16();
+
+    // tokens are shaped in isolation: no bidi reordering, no positional tabs
+    for (auto i = 0; i < length; ++i) {
+        uint ucs4 = data[i];
+        if (ucs4 == '\t') return false;
+        if (QChar::isHighSurrogate(ucs4) && i + 1 < length && QChar::isLowSurrogate(data[i + 1])) {
+            ucs4 = QChar::surrogateToUcs4(data[i], data[i + 1]);
+        }
+        switch (QChar::direction(ucs4)) {
+        case QChar::DirR:
+        case QChar::DirAL:
+        case QChar::DirRLE:
+        case QChar::DirRLO:
+        case QChar::DirRLI:
+            return false;
+        default:
+            break;
+        }
+    }
+
+    auto font = m_font->getFont();
+    QVarLengthArray<QFont, 4> fonts;
+    QVarLengthArray<QString, 4> fontKeys;
+    fonts.append(font);
+    fontKeys.append(font.key());
+    QVarLengthArray<uchar, 256> fontOf(length);
+    std::fill(fontOf.begin(), fontOf.end(), uchar(0));
+    for (const FontSpan &span : m_fontSpans) {
+        QFont variant(font);
+        variant.setItalic(span.payload.italic);
+        variant.setWeight(span.payload.weight);
+        auto key = variant.key();
+        auto ix = std::find(fontKeys.begin(), fontKeys.end(), key) - fontKeys.begin();
+        if (ix == fontKeys.size()) {
+            if (ix > 0xff) return false;
+            fonts.append(variant);
+            fontKeys.append(key);
+        }
+        auto start = qBound(0, span.range.start(), length);
+        auto end = qBound(start, span.range.end(), length);
+        std::fill(fontOf.begin() + start, fontOf.begin() + end, uchar(ix));
+    }
+
+    QVarLengthArray<PaletteColor, 8> colors;
+    QVarLengthArray<uchar, 256> colorOf;
+    if (!resolveColors(buildDefault, colors, colorOf)) return false;
+
+    // 0 space, 1 word, 2 anything else; marks and low surrogates never start a token
+    auto tokenClass = [](ushort u) {
+        QChar c(u);
+        if (c.isSpace()) return 0;
+        if (c.isLetterOrNumber() || u == '_') return 1;
+        return 2;
+    };
+    auto continues = [](ushort u) {
+        return QChar::isLowSurrogate(u) || QChar(u).isMark();
+    };
+
+    auto cache = ShapingCache::shared();
+    textline.m_cursorX.resize(length + 1);
+    qreal x = 0;
+    for (auto i = 0; i < length;) {
+        auto cls = tokenClass(data[i]);
+        auto j = i + 1;
+        while (j < length && (continues(data[j]) || (tokenClass(data[j]) == cls && fontOf[j] == fontOf[i] && colorOf[j] == colorOf[i]))) {
+            ++j;
+        }
+        auto text = m_text.mid(i, j - i);
+        auto token = m_cachedOnly ? cache->find(text, fontKeys[fontOf[i]]) : cache->token(text, fonts[fontOf[i]], fontKeys[fontOf[i]]);
+        if (!token) return false;
+        for (auto k = i; k < j; ++k) {
+            textline.m_cursorX[k] = x + token->cursorX[k - i];
+        }
+
+        auto color = colors[colorOf[i]];
+        foreach (const QGlyphRun &run, token->runs) {
+            auto positions = run.positions();
+            for (auto &pos : positions) {
+                pos.rx() += x;
+            }
+            auto &runs = textline.m_glyphRuns;
+            if (!runs.isEmpty() && runs.last().color == color.color && runs.last().slot == color.slot && runs.last().run.rawFont() == run.rawFont()) {
+                auto &last = runs.last().run;
+                last.setGlyphIndexes(last.glyphIndexes() + run.glyphIndexes());
+                last.setPositions(last.positions() + positions);
+            } else {
+                QGlyphRun placed(run);
+                placed.setPositions(positions);
+                ColoredGlyphRun colored = {placed, color.color, nullptr, color.slot};
+                runs.append(colored);
+            }
+        }
+        x += token->width;
+        i = j;
+    }
+    textline.m_cursorX[length] = x;
+
+    for (const ColorSpan &span : m_selSpans) {
+        if (span.payload.isValid()) {
+            auto start = qBound(0, span.range.start(), length);
+            auto end = qBound(start, span.range.end(), length);
+            BackgroundColorRange bg = {RangeF(textline.m_cursorX[start], textline.m_cursorX[end]), span.payload};
+            textline.m_backgrounds.append(bg);
+        }
+    }
+
+    textline.m_lineTop = textline.metrics()->leading();
+    textline.m_width = x;
+    return true;
+}
+
+template <typename T>
+static void clipSpans(const SpanBuffer<T> &from, SpanBuffer<T> &to, int start, int end) {
+    for (const Span<T> &span : from) {
+        auto s = qMax(start, span.range.start());
+        auto e = qMin(end, span.range.end());
+        if (s < e) to.append(Span<T>(RangeI(s - start, e - start), span.payload));
+    }
+}
+
+std::shared_ptr<TextLineBuilder> TextLineBuilder::slice(int start, int end) const {
+    auto builder = std::make_shared<TextLineBuilder>(m_text.mid(start, end - start), m_font);
+    builder->m_defaultFgColor = m_defaultFgColor;
+    clipSpans(m_fontSpans, builder->m_fontSpans, start, end);
+    clipSpans(m_fgSpans, builder->m_fgSpans, start, end);
+    clipSpans(m_selSpans, builder->m_selSpans, start, end);
+    clipSpans(m_fakeItalicSpans, builder->m_fakeItalicSpans, start, end);
+    clipSpans(m_underlineSpans, builder->m_underlineSpans, start, end);
+    clipSpans(m_styleSpans, builder->m_styleSpans, start, end);
+    return builder;
+}
+
+std::shared_ptr<TextLine> TextLineBuilder::buildChunked(bool buildDefault) {
+    auto textline = std::make_shared<TextLine>(m_offsets, m_font);
+    auto font = m_font->getFont();
+    auto face = m_cachedOnly ? GlyphCache::shared()->find(font) : GlyphCache::shared()->face(font);
+    // exact for monospace text, corrected as chunks get built
+    auto advance = face && face->isValid() ? face->advance() : textline->metrics()->averageCharWidth();
+
+    auto length = m_text.length();
+    auto data = m_text.utf16();
+    for (auto start = 0; start < length;) {
+        auto end = qMin(length, start + TextLine::kChunkLength);
+        // never split a surrogate pair or a mark from its base
+        while (end < length && (QChar::isLowSurrogate(data[end]) || QChar(data[end]).isMark())) {
+            ++end;
+        }
+        TextLineChunk chunk;
+        chunk.range = RangeI(start, end);
+        chunk.width = (end - start) * advance;
+        textline->m_chunks.append(chunk);
+        start = end;
+    }
+
+    textline->m_chunkSource = std::make_shared<TextLineBuilder>(*this);
+    textline->m_chunkSource->m_cachedOnly = false; // chunks are built on the GUI thread, while painting
+    textline->m_chunkDefault = buildDefault;
+    textline->m_lineTop = textline->metrics()->leading();
+    textline->placeChunks(0);
+    return textline;
+}
+
+std::shared_ptr<TextLine> TextLineBuilder::buildCached(bool buildDefault) {
+    m_cachedOnly = true;
+    if (m_text.length() > TextLine::kChunkThreshold) {
+        return buildChunked(buildDefault);
+    }
+    auto textline = std::make_shared<TextLine>(m_offsets, m_font);
+    if (buildMonospace(*textline, buildDefault)) {
+        return textline;
+    }
+    if (buildShaped(*textline, buildDefault)) {
+        return textline;
+    }
+    return nullptr;
+}
+
 std::shared_ptr<xi::TextLine> TextLineBuilder::build(bool buildDefault) {
-    auto textline = std::make_shared<TextLine>(m_text, m_font);
+    if (m_text.length() > TextLine::kChunkThreshold) {
+        return buildChunked(buildDefault);
+    }
+    auto textline = std::make_shared<TextLine>(m_offsets, m_font);
+    if (buildMonospace(*textline, buildDefault)) {
+        return textline;
+    }
+    if (buildShaped(*textline, buildDefault)) {
+        return textline;
+    }
+
+    m_overrides.reserve(1 + m_fontSpans.size() + m_fgSpans.size() + m_styleSpans.size() + m_selSpans.size());
+    textline->m_layout = std::make_shared<QTextLayout>(m_text, m_font->getFont());
     int leading = textline->metrics()->leading();
     auto lineWidth = textline->metrics()->width(m_text); // slow
 
@@ -45,53 +623,71 @@ std::shared_ptr<xi::TextLine> TextLineBuilder::build(bool buildDefault) {
         fmt.length = lineWidth;
         fmt.format = cfmt;
         m_overrides.push_back(fmt);
+        textline->m_layoutColors.append({RangeI(0, m_text.length()), {m_defaultFgColor, LinePalette::kForeground}});
     }
 
-    foreach (std::shared_ptr<FontSpan> span, m_fontSpans) {
-        QTextLayout::FormatRange fmt;
-        QTextCharFormat cfmt;
-        if (span->payload.italic || span->payload.weight) {
-            cfmt.setFontItalic(span->payload.italic);
-            cfmt.setFontWeight(span->payload.weight);
-            fmt.start = span->range.start();
-            fmt.length = span->range.length();
-            fmt.format = cfmt;
-            m_overrides.push_back(fmt);
+    if (m_styleSpans.isEmpty()) {
+        for (const FontSpan &span : m_fontSpans) {
+            QTextLayout::FormatRange fmt;
+            QTextCharFormat cfmt;
+            if (span.payload.italic || span.payload.weight) {
+                cfmt.setFontItalic(span.payload.italic);
+                cfmt.setFontWeight(span.payload.weight);
+                fmt.start = span.range.start();
+                fmt.length = span.range.length();
+                fmt.format = cfmt;
+                m_overrides.push_back(fmt);
+            }
         }
-    }
-    
-    foreach (std::shared_ptr<ColorSpan> span, m_fgSpans) {
-        QTextLayout::FormatRange fmt;
-        QTextCharFormat cfmt;
-        if (span->payload.isValid()) {
-            cfmt.setForeground(span->payload);
-            fmt.start = span->range.start();
-            fmt.length = span->range.length();
-            fmt.format = cfmt;
+
+        for (const PaletteSpan &span : m_fgSpans) {
+            QTextLayout::FormatRange fmt;
+            QTextCharFormat cfmt;
+            if (span.payload.color.isValid()) {
+                cfmt.setForeground(span.payload.color);
+                fmt.start = span.range.start();
+                fmt.length = span.range.length();
+                fmt.format = cfmt;
+                m_overrides.push_back(fmt);
+                textline->m_layoutColors.append({span.range, span.payload});
+            }
+        }
+    } else {
+        // styled by a StyleTable, formats are already built
+        for (const Span<StyleFormat> &span : m_styleSpans) {
+            QTextLayout::FormatRange fmt;
+            fmt.start = span.range.start();
+            fmt.length = span.range.length();
+            fmt.format = span.payload.format;
             m_overrides.push_back(fmt);
+            if (fmt.format.hasProperty(QTextFormat::ForegroundBrush)) {
+                PaletteColor color = {fmt.format.foreground().color(), LinePalette::styleSlot(span.payload.id)};
+                textline->m_layoutColors.append({span.range, color});
+            }
         }
     }
 
-    foreach (std::shared_ptr<ColorSpan> span, m_selSpans) {
+    for (const ColorSpan &span : m_selSpans) {
         QTextLayout::FormatRange fmt;
         QTextCharFormat cfmt;
-        if (span->payload.isValid()) {
-            cfmt.setBackground(span->payload);
-            fmt.start = span->range.start();
-            fmt.length = span->range.length();
+        if (span.payload.isValid()) {
+            cfmt.setBackground(span.payload);
+            fmt.start = span.range.start();
+            fmt.length = span.range.length();
             fmt.format = cfmt;
             m_overrides.push_back(fmt);
+            textline->m_layoutColors.append({span.range, {span.payload, LinePalette::kSelection}, true});
         }
     }
 
-    //foreach (std::shared_ptr<UnderlineSpan> span, m_underlineSpans) {
+    //for (const UnderlineSpan &span : m_underlineSpans) {
     //    QTextLayout::FormatRange fmt;
     //    QTextCharFormat cfmt;
     //    cfmt.setFont(m_font->getFont());
     //    cfmt.setFontUnderline(true);
     //    cfmt.setUnderlineStyle(QTextCharFormat::SingleUnderline);
-    //    fmt.start = span->range.start();
-    //    fmt.length = span->range.length();
+    //    fmt.start = span.range.start();
+    //    fmt.length = span.range.length();
     //    fmt.format = cfmt;
     //    m_overrides.push_back(fmt);
     //}
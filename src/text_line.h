@@ -3,19 +3,71 @@
 
 #include <QFontMetrics>
 #include <QFontMetricsF>
+#include <QGlyphRun>
 #include <QObject>
 #include <QPainter>
 #include <QTextCharFormat>
 #include <QTextLayout>
+#include <QVarLengthArray>
 
 #include <memory>
 
 #include "font.h"
+#include "offset_index.h"
 #include "range.h"
 #include "style_span.h"
 
 namespace xi {
 
+class MonospaceFace;
+class TextLine;
+class TextLineBuilder;
+
+// Colors of a built line name palette slots as well, resolved when the line
+// is drawn, so a new theme recolors laid out lines instead of shaping them again
+class LinePalette {
+public:
+    static constexpr int kNone = -1; // a literal color, never resolved
+    static constexpr int kForeground = 0;
+    static constexpr int kSelection = 1;
+    static constexpr int kFirstStyle = 2;
+
+    static inline int styleSlot(int id) {
+        return kFirstStyle + id;
+    }
+
+    explicit LinePalette(int revision = 0) : m_revision(revision) {
+    }
+
+    // unique per palette, for caches of drawn lines
+    inline int revision() const {
+        return m_revision;
+    }
+    // fallback, the color the line was built with, for slots without a color
+    inline QColor color(int slot, const QColor &fallback) const {
+        if (slot < 0 || slot >= m_colors.size() || !m_colors[slot].isValid()) return fallback;
+        return m_colors[slot];
+    }
+    void setColor(int slot, const QColor &color);
+
+private:
+    QVector<QColor> m_colors;
+    int m_revision;
+};
+
+inline QColor resolveColor(const LinePalette *palette, int slot, const QColor &color) {
+    return palette ? palette->color(slot, color) : color;
+}
+
+// a color as built, with the palette slot it came from
+struct PaletteColor {
+    QColor color;
+    int slot = LinePalette::kNone;
+    inline bool operator==(const PaletteColor &other) const {
+        return slot == other.slot && color == other.color;
+    }
+};
+
 struct SelRange {
     QColor color;
     RangeI range;
@@ -24,6 +76,21 @@ struct SelRange {
 struct BackgroundColorRange {
     RangeF range;
     QColor color;
+    int slot = LinePalette::kSelection;
+};
+
+struct ColoredGlyphRun {
+    QGlyphRun run;
+    QColor color; // invalid: painter pen
+    std::shared_ptr<MonospaceFace> face;
+    int slot = LinePalette::kNone;
+};
+
+// foreground or background of a QTextLayout range, recolored through draw overrides
+struct LayoutColor {
+    RangeI range;
+    PaletteColor color;
+    bool background = false;
 };
 
 struct UnderlineRange {
@@ -53,6 +120,18 @@ struct Span {
 };
 
 struct Empty {
+    inline bool operator==(const Empty &) const {
+        return true;
+    }
+};
+
+// a style id with its prebuilt format, compared by id only
+struct StyleFormat {
+    int id = -1;
+    QTextCharFormat format;
+    inline bool operator==(const StyleFormat &other) const {
+        return id == other.id;
+    }
 };
 
 enum class UnderlineStyle {
@@ -61,23 +140,126 @@ enum class UnderlineStyle {
 };
 
 using ColorSpan = Span<QColor>;
+using PaletteSpan = Span<PaletteColor>;
 using UnderlineSpan = Span<UnderlineStyle>;
 using SimpleSpan = Span<Empty>;
 using FontSpan = Span<FontStyle>;
 
+// spans of one line live on the builder's stack
+template <typename T>
+using SpanBuffer = QVarLengthArray<Span<T>, 32>;
+
+// extends the previous span instead of appending when they touch and match
+template <typename T>
+inline void appendSpan(SpanBuffer<T> &spans, const RangeI &range, const T &payload) {
+    if (range.isEmpty()) return;
+    if (!spans.isEmpty()) {
+        auto &last = spans.last();
+        if (last.range.end() == range.start() && last.payload == payload) {
+            last.range = RangeI(last.range.start(), range.end());
+            return;
+        }
+    }
+    spans.append(Span<T>(range, payload));
+}
+
+// Receives what TextLine::draw would paint, for renderers without a QPainter
+class TextLineVisitor {
+public:
+    virtual ~TextLineVisitor() {}
+    virtual void rect(const QRectF &rect, const QColor &color) = 0;
+    // glyph positions are relative to origin, an invalid color is the default foreground
+    virtual void glyphs(const QPointF &origin, const QGlyphRun &run, const QColor &color) = 0;
+};
+
+// One visit of a line, recorded on the GUI thread with its colors resolved.
+// Replaying it never touches the TextLine, so any thread can draw it. Font
+// engines belong to the thread that made them: glyph runs keep a description
+// of their font and are replayed with an equivalent QRawFont of the replaying
+// thread, no QRawFont of the GUI thread is kept.
+class RecordedLine : public TextLineVisitor {
+public:
+    void rect(const QRectF &rect, const QColor &color) override;
+    void glyphs(const QPointF &origin, const QGlyphRun &run, const QColor &color) override;
+
+    void replay(TextLineVisitor &visitor) const;
+
+private:
+    struct FontDescription {
+        QString family;
+        QString style;
+        qreal pixelSize;
+        int weight;
+        QFont::Style slant;
+
+        inline bool operator==(const FontDescription &other) const {
+            return family == other.family && style == other.style && pixelSize == other.pixelSize && weight == other.weight && slant == other.slant;
+        }
+    };
+    struct Op {
+        QRectF rect;
+        QPointF origin;
+        QVector<quint32> glyphs;
+        QVector<QPointF> positions;
+        int font; // into m_fonts, -1 for rects
+        QColor color;
+    };
+
+    static QRawFont localFont(const FontDescription &font);
+
+    QVector<FontDescription> m_fonts;
+    QVector<Op> m_ops;
+};
+
+// A slice of a very long line, built when it first scrolls into view
+struct TextLineChunk {
+    RangeI range; // utf16, in the whole line
+    qreal x = 0;
+    qreal width = 0; // estimated until line is built
+    std::shared_ptr<TextLine> line;
+};
+
 // Render info, line
 class TextLine {
     friend class TextLineBuilder;
 
 public:
-    explicit TextLine(const QString &text, std::shared_ptr<Font> font);
+    // longer lines are split into chunks of kChunkLength utf16 units
+    static constexpr int kChunkThreshold = 16 * 1024;
+    static constexpr int kChunkLength = 2048;
+
+    explicit TextLine(const OffsetIndex &offsets, std::shared_ptr<Font> font);
 
     int xToIndex(qreal x);
     qreal indexTox(int ix);
 
+    // palette: current colors of the slots the line was built with, nullptr draws it as built
+    void draw(QPainter &painter, const QPointF &pos, const LinePalette *palette = nullptr);
+    // the same as draw, backgrounds first, limited to chunks overlapping [left, right)
+    void visit(TextLineVisitor &visitor, const QPointF &pos, qreal left, qreal right, const LinePalette *palette = nullptr);
+
+    // rough heap footprint in bytes, the LayoutCache budget
+    int memoryCost() const;
+
     inline qreal width() const {
         return m_width;
     }
+    // unique per built line, never reused
+    inline quint64 id() const {
+        return m_id;
+    }
+    // laid out arithmetically from cached glyphs, no QTextLayout
+    inline bool isMonospace() const {
+        return !m_layout && m_cursorX.isEmpty() && m_chunks.isEmpty();
+    }
+    // assembled from cached shaped tokens
+    inline bool isShaped() const {
+        return !m_layout && !m_cursorX.isEmpty();
+    }
+    // split into chunks, only those in view are laid out
+    inline bool isChunked() const {
+        return !m_chunks.isEmpty();
+    }
     inline std::shared_ptr<QTextLayout> layout() const {
         return m_layout;
     }
@@ -89,83 +271,123 @@ public:
     }
 
 protected:
+    quint64 m_id;
     std::shared_ptr<Font> m_font;
     QString m_text;
+    OffsetIndex m_offsets;
     qreal m_width;
 
-    std::shared_ptr<QList<StyleSpan>> m_styles;
+    std::shared_ptr<StyleSpans> m_styles;
     std::shared_ptr<QFontMetricsF> m_fontMetrics;
     std::shared_ptr<QTextLayout> m_layout;
     std::shared_ptr<QList<SelRange>> m_selRanges;
+
+    // monospace and shaped token paths
+    qreal m_advance = 0;
+    qreal m_lineTop = 0;
+    QVector<qreal> m_cursorX; // shaped tokens only
+    QVector<ColoredGlyphRun> m_glyphRuns;
+    QVector<BackgroundColorRange> m_backgrounds;
+
+    // QTextLayout path, formats bake colors in and changing them reshapes
+    QVector<LayoutColor> m_layoutColors;
+    QVector<QTextLayout::FormatRange> layoutOverrides(const LinePalette *palette) const;
+    void visitLayout(TextLineVisitor &visitor, const QPointF &pos, const LinePalette *palette) const;
+
+    // chunked lines only
+    int chunkAt(qreal x) const;
+    int chunkOf(int utf16) const;
+    TextLine &chunkLine(int ix);
+    void placeChunks(int from);
+    QVector<TextLineChunk> m_chunks;
+    std::shared_ptr<TextLineBuilder> m_chunkSource; // spans of the whole line, sliced per chunk
+    bool m_chunkDefault = false;
 };
 
 class TextLineBuilder {
+    friend class TextLine;
+
 public:
     TextLineBuilder(const QString &text, std::shared_ptr<Font> font) {
+        m_offsets = OffsetIndex(text);
         m_text = text;
         m_font = font;
     }
+    TextLineBuilder(const OffsetIndex &offsets, std::shared_ptr<Font> font) {
+        m_offsets = offsets;
+        m_text = offsets.text();
+        m_font = font;
+    }
 
     void setFgColor(const QColor &color) {
         m_defaultFgColor = color;
     }
 
     void addFontSpan(const RangeI &range, const FontStyle &info) {
-        if (!range.isEmpty()) {
-            m_fontSpans.append(std::make_shared<FontSpan>(range, info));
-        }
+        appendSpan(m_fontSpans, range, info);
     }
 
-    void addFgSpan(const RangeI &range, const QColor &color) {
-        if (!range.isEmpty()) {
-            m_fgSpans.append(std::make_shared<ColorSpan>(range, color));
-        }
+    // slot: where a palette finds the current color, see LinePalette
+    void addFgSpan(const RangeI &range, const QColor &color, int slot = LinePalette::kNone) {
+        appendSpan(m_fgSpans, range, PaletteColor{color, slot});
     }
 
     void addSelSpan(const RangeI &range, const QColor &color) {
-        if (!range.isEmpty()) {
-            m_selSpans.append(std::make_shared<ColorSpan>(range, color));
-        }
+        appendSpan(m_selSpans, range, color);
     }
 
     void addFakeItalicSpan(const RangeI &range) {
-        if (!range.isEmpty()) {            
-            m_fakeItalicSpans.append(std::make_shared<SimpleSpan>(range, Empty()));
-        }
+        appendSpan(m_fakeItalicSpans, range, Empty());
     }
 
     void addUnderlineSpan(const RangeI &range, UnderlineStyle style) {
-        if (!range.isEmpty()) {
-            m_underlineSpans.append(std::make_shared<UnderlineSpan>(range, style));
-        }
+        appendSpan(m_underlineSpans, range, style);
+    }
+
+    // fg color and font of a style in one QTextLayout format
+    void addStyleSpan(const RangeI &range, int id, const QTextCharFormat &format) {
+        appendSpan(m_styleSpans, range, StyleFormat{id, format});
     }
 
-    // init QTextLayout
+    // glyph runs for simple monospace text, then cached shaped tokens, then a QTextLayout
     std::shared_ptr<TextLine> build(bool buildDefault = false);
+    // glyph runs from faces and tokens that already exist, without creating font
+    // engines or shaping. Safe off the GUI thread, nullptr when the line needs more.
+    std::shared_ptr<TextLine> buildCached(bool buildDefault = false);
 
 private:
+    // builder for text [start, end) with every span clipped and shifted to it
+    std::shared_ptr<TextLineBuilder> slice(int start, int end) const;
+    std::shared_ptr<TextLine> buildChunked(bool buildDefault);
+    bool resolveColors(bool buildDefault, QVarLengthArray<PaletteColor, 8> &colors, QVarLengthArray<uchar, 256> &colorOf) const;
+    bool buildMonospace(TextLine &textline, bool buildDefault);
+    bool buildShaped(TextLine &textline, bool buildDefault);
+
     QVector<QTextLayout::FormatRange> m_overrides;
     
     std::shared_ptr<Font> m_font;
     QString m_text;
+    OffsetIndex m_offsets;
     QColor m_defaultFgColor;
+    bool m_cachedOnly = false;
 
     // TODO: MULTI FONTS
     //QList<std::shared_ptr<Font>> m_fonts;
 
-    QList<std::shared_ptr<FontSpan>> m_fontSpans;
-    QList<std::shared_ptr<ColorSpan>> m_fgSpans;
-    QList<std::shared_ptr<ColorSpan>> m_selSpans;
-    QList<std::shared_ptr<SimpleSpan>> m_fakeItalicSpans;
-    QList<std::shared_ptr<UnderlineSpan>> m_underlineSpans;
+    SpanBuffer<FontStyle> m_fontSpans;
+    SpanBuffer<PaletteColor> m_fgSpans;
+    SpanBuffer<QColor> m_selSpans;
+    SpanBuffer<Empty> m_fakeItalicSpans;
+    SpanBuffer<UnderlineStyle> m_underlineSpans;
+    SpanBuffer<StyleFormat> m_styleSpans;
 };
 
 class Painter {
 public:
     //static void drawLineBg(QPainter &painter, const std::shared_ptr<TextLine> &line, qreal x, const RangeF &y);
 
-    static void drawLine(QPainter &painter, std::shared_ptr<TextLine> line, qreal x, qreal y) {
-        line->layout()->draw(&painter, QPoint(x, y));
+    static void drawLine(QPainter &painter, std::shared_ptr<TextLine> line, qreal x, qreal y, const LinePalette *palette = nullptr) {
+        line->draw(painter, QPoint(x, y), palette);
     }
 
     //static void drawLineDecorations(QPainter &painter, const std::shared_ptr<TextLine> &line, qreal x, qreal y) {
@@ -3,14 +3,58 @@
 
 #include <QBrush>
 #include <QColor>
-#include <QHash>
 #include <QJsonObject>
+#include <QPen>
 #include <QString>
 
+#include <array>
+#include <memory>
+
+#include <magic_enum.hpp>
+
 #include "unfair_lock.h"
 
 namespace xi {
 
+// The theme schema, enumerator names are the keys core sends
+// https://docs.rs/syntect/2.1.0/syntect/highlighting/struct.ThemeSettings.html
+enum class ThemeKey {
+    accent,                        // A color made available for use by the theme.
+    active_guide,                  // Color of the guide lined up with the caret. Only applied if the indent_guide_options setting is set to draw_active.
+    background,                    // The default backgound color of the view.
+    bracket_contents_foreground,   // Color of bracketed sections of text when the caret is in a bracketed section. Only applied when the match_brackets setting is set to true.
+    bracket_contents_options,      // Controls certain options when the caret is in a bracket section. Only applied when the match_brackets setting is set to true.
+    brackets_background,           // Background color of the brackets when the caret is next to a bracket. Only applied when the match_brackets setting is set to true.
+    brackets_foreground,           // Foreground color of the brackets when the caret is next to a bracket. Only applied when the match_brackets setting is set to true.
+    brackets_options,              // Controls certain options when the caret is next to a bracket. Only applied when the match_brackets setting is set to true.
+    caret,                         // Color of the caret.
+    find_highlight,                // Background color of regions matching the current search.
+    find_highlight_foreground,     // Text color of regions matching the current search.
+    foreground,                    // The default color for text.
+    guide,                         // Color of the guides displayed to indicate nesting levels.
+    gutter,                        // Background color of the gutter.
+    gutter_foreground,             // Foreground color of the gutter.
+    highlight,                     // The border color for "other" matches.
+    highlight_foreground,          // Deprecated!
+    inactive_selection,            // The background color of a selection in a view that is not currently focused.
+    inactive_selection_foreground, // A color that will override the scope-based text color of the selection in a view that is not currently focused.
+    line_highlight,                // Color of the line the caret is in. Only used when the higlight_line setting is set to true.
+    minimap_border,                // The color of the border drawn around the viewport area of the minimap. Only used when the draw_minimap_border setting is enabled.
+    misspelling,                   // The color to use for the squiggly underline drawn under misspelled words.
+    phantom_css,                   // CSS passed to phantoms.
+    popup_css,                     // CSS passed to popups.
+    selection,                     // The background color of selected text.
+    selection_background,          // Deprecated!
+    selection_border,              // Color of the selection regions border.
+    selection_foreground,          // A color that will override the scope-based text color of the selection.
+    shadow,                        // The color of the shadow used when a text area can be horizontally scrolled.
+    stack_guide,                   // Color of the current guides parent guide level. Only used if the indent_guide_options setting is set to draw_active.
+    tags_foreground,               // Color of tags when the caret is next to a tag. Only used when the match_tags setting is set to true.
+    tags_options,                  // Controls certain options when the caret is next to a tag. Only applied when the match_tags setting is set to true.
+};
+
+constexpr std::size_t kThemeKeys = magic_enum::enum_count<ThemeKey>();
+
 struct ThemeElement {
     enum Type {
         Color,
@@ -46,30 +90,110 @@ struct ThemeElement {
         }
         return *this;
     }
-    operator QColor() {
+    operator QColor() const {
         return color;
     }
-    operator QString() {
+    operator QString() const {
         return option;
     }
 };
 
-#define THEME_ELEMENT_METHOD(TypeName)                                                     \
-    inline void TypeName(const ThemeElement &element) { m_elements[#TypeName] = element; } \
-    inline ThemeElement TypeName() const { return m_elements[#TypeName]; }
+#define THEME_SNAPSHOT_METHOD(TypeName) \
+    inline const ThemeElement &TypeName() const { return m_elements[std::size_t(ThemeKey::TypeName)]; }
+
+#define THEME_ELEMENT_METHOD(TypeName)                                                          \
+    inline void TypeName(const ThemeElement &element) { setElement(ThemeKey::TypeName, element); } \
+    inline ThemeElement TypeName() const { return m_snapshot->TypeName(); }
 
 #define THEME_LOCKED_METHOD(TypeName)                                                 \
     inline void TypeName(const ThemeElement &element) { m_inner->TypeName(element); } \
     inline ThemeElement TypeName() const { return m_inner->TypeName(); }
 
+// One version of a theme, never changed once published
+class ThemeSnapshot {
+    friend class ThemeState;
+
+public:
+    using Elements = std::array<ThemeElement, kThemeKeys>;
+
+    inline QString name() const {
+        return m_name;
+    }
+    // unique across all ThemeStates, changes with every update
+    inline int revision() const {
+        return m_revision;
+    }
+
+    // built once per update, invalid, Qt::NoBrush and Qt::NoPen for non colors
+    inline const QColor &color(ThemeKey key) const {
+        return m_elements[std::size_t(key)].color;
+    }
+    inline const QBrush &brush(ThemeKey key) const {
+        return m_brushes[std::size_t(key)];
+    }
+    inline const QPen &pen(ThemeKey key) const {
+        return m_pens[std::size_t(key)];
+    }
+
+    THEME_SNAPSHOT_METHOD(accent);
+    THEME_SNAPSHOT_METHOD(active_guide);
+    THEME_SNAPSHOT_METHOD(background);
+    THEME_SNAPSHOT_METHOD(bracket_contents_foreground);
+    THEME_SNAPSHOT_METHOD(bracket_contents_options);
+    THEME_SNAPSHOT_METHOD(brackets_background);
+    THEME_SNAPSHOT_METHOD(brackets_foreground);
+    THEME_SNAPSHOT_METHOD(brackets_options);
+    THEME_SNAPSHOT_METHOD(caret);
+    THEME_SNAPSHOT_METHOD(find_highlight);
+    THEME_SNAPSHOT_METHOD(find_highlight_foreground);
+    THEME_SNAPSHOT_METHOD(foreground);
+    THEME_SNAPSHOT_METHOD(guide);
+    THEME_SNAPSHOT_METHOD(gutter);
+    THEME_SNAPSHOT_METHOD(gutter_foreground);
+    THEME_SNAPSHOT_METHOD(highlight);
+    THEME_SNAPSHOT_METHOD(highlight_foreground);
+    THEME_SNAPSHOT_METHOD(inactive_selection);
+    THEME_SNAPSHOT_METHOD(inactive_selection_foreground);
+    THEME_SNAPSHOT_METHOD(line_highlight);
+    THEME_SNAPSHOT_METHOD(minimap_border);
+    THEME_SNAPSHOT_METHOD(misspelling);
+    THEME_SNAPSHOT_METHOD(phantom_css);
+    THEME_SNAPSHOT_METHOD(popup_css);
+    THEME_SNAPSHOT_METHOD(selection);
+    THEME_SNAPSHOT_METHOD(selection_background);
+    THEME_SNAPSHOT_METHOD(selection_border);
+    THEME_SNAPSHOT_METHOD(selection_foreground);
+    THEME_SNAPSHOT_METHOD(shadow);
+    THEME_SNAPSHOT_METHOD(stack_guide);
+    THEME_SNAPSHOT_METHOD(tags_foreground);
+    THEME_SNAPSHOT_METHOD(tags_options);
+
+private:
+    void buildPaint(ThemeKey key);
+
+    QString m_name;
+    Elements m_elements;
+    std::array<QBrush, kThemeKeys> m_brushes;
+    std::array<QPen, kThemeKeys> m_pens;
+    int m_revision = 0;
+};
+
 class ThemeState : public UnfairLock {
 public:
-    using Elements = QHash<QString, ThemeElement>;
+    using Elements = ThemeSnapshot::Elements;
 
     ThemeState();
 
     void applyUpdate(const QString &name, const QJsonObject &json);
 
+    inline int revision() const {
+        return m_snapshot->revision();
+    }
+    // the only member readers may call without the lock
+    inline std::shared_ptr<const ThemeSnapshot> snapshot() const {
+        return std::atomic_load(&m_snapshot);
+    }
+
     THEME_ELEMENT_METHOD(accent);
     THEME_ELEMENT_METHOD(active_guide);
     THEME_ELEMENT_METHOD(background);
@@ -104,9 +228,11 @@ public:
     THEME_ELEMENT_METHOD(tags_options);
 
 private:
-    void merge(const Elements &elements);
-    QString m_name;
-    Elements m_elements;
+    void setElement(ThemeKey key, const ThemeElement &element);
+    void publish(const std::shared_ptr<ThemeSnapshot> &snapshot);
+    void merge(Elements &elements);
+
+    std::shared_ptr<const ThemeSnapshot> m_snapshot; // swapped atomically, written under the lock
 };
 
 class ThemeLocked {
@@ -123,6 +249,10 @@ public:
         m_inner->applyUpdate(name, json);
     }
 
+    inline int revision() const {
+        return m_inner->revision();
+    }
+
     THEME_LOCKED_METHOD(accent);
     THEME_LOCKED_METHOD(active_guide);
     THEME_LOCKED_METHOD(background);
@@ -173,6 +303,11 @@ public:
         return std::make_shared<ThemeLocked>(m_state);
     }
 
+    // for painting, takes no lock, hold it for the whole frame
+    inline std::shared_ptr<const ThemeSnapshot> snapshot() const {
+        return m_state->snapshot();
+    }
+
 private:
     std::shared_ptr<ThemeState> m_state;
 };
@@ -0,0 +1,180 @@
+#include "wrap_index.h"
+
+#include <algorithm>
+
+namespace xi {
+
+QVector<int> WrapIndex::wrap(const QString &text, int columns) {
+    QVector<int> breaks;
+    auto length = text.length();
+    // the newline doesn't take a column
+    while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r')) {
+        --length;
+    }
+    auto start = 0;
+    while (length - start > columns) {
+        auto end = start + columns;
+        auto brk = end;
+        for (auto i = end; i > start + 1; --i) {
+            if (text[i - 1].isSpace()) {
+                brk = i;
+                break;
+            }
+        }
+        if (text[brk].isLowSurrogate() && brk - 1 > start) --brk;
+        breaks.append(brk);
+        start = brk;
+    }
+    return breaks;
+}
+
+void WrapIndex::sync(const CacheLines &lines, int columns) {
+    if (columns != m_columns) {
+        m_columns = columns;
+        m_lines.clear();
+        m_breaks.clear();
+    }
+
+    auto count = lines.size();
+    auto old = m_lines.size();
+    auto head = 0;
+    while (head < count && head < old && lines[head] == m_lines[head]) {
+        ++head;
+    }
+    if (head == count && count == old) return;
+    auto tail = 0;
+    while (tail < count - head && tail < old - head && lines[count - 1 - tail] == m_lines[old - 1 - tail]) {
+        ++tail;
+    }
+
+    auto wrapLine = [this](const std::shared_ptr<Line> &line) {
+        return line ? wrap(line->getText(), m_columns) : QVector<int>();
+    };
+
+    if (count == old && !m_tree.isEmpty()) {
+        // lines replaced in place, only their rows change
+        for (auto i = head; i < count - tail; ++i) {
+            update(i, lines[i]);
+        }
+        return;
+    }
+
+    // lines inserted or removed: wrap the changed middle, rebuild the tree
+    QVector<QVector<int>> breaks;
+    breaks.reserve(count);
+    breaks += m_breaks.mid(0, head);
+    for (auto i = head; i < count - tail; ++i) {
+        breaks.append(wrapLine(lines[i]));
+    }
+    breaks += m_breaks.mid(old - tail);
+    m_breaks = breaks;
+    m_lines = lines;
+    build();
+}
+
+void WrapIndex::update(int ix, const std::shared_ptr<Line> &line) {
+    if (ix < 0 || ix >= m_breaks.size() || line == m_lines[ix]) return;
+    auto breaks = line ? wrap(line->getText(), m_columns) : QVector<int>();
+    add(ix, breaks.size() - m_breaks[ix].size());
+    m_breaks[ix] = breaks;
+    m_lines[ix] = line;
+}
+
+void WrapIndex::move(const QVector<LineMove> &moves, const std::function<std::shared_ptr<Line>(int)> &lineAt) {
+    CacheLines lines;
+    QVector<QVector<int>> breaks;
+    for (const LineMove &move : moves) {
+        for (auto i = 0; i < move.count; ++i) {
+            auto from = move.from < 0 ? -1 : move.from + i;
+            if (from >= 0 && from < m_lines.size()) {
+                lines.append(std::move(m_lines[from]));
+                breaks.append(std::move(m_breaks[from]));
+            } else {
+                auto line = lineAt(move.start + i);
+                lines.append(line);
+                breaks.append(line ? wrap(line->getText(), m_columns) : QVector<int>());
+            }
+        }
+    }
+    m_lines = lines;
+    m_breaks = breaks;
+    build();
+}
+
+void WrapIndex::clear() {
+    m_columns = 0;
+    m_lines.clear();
+    m_breaks.clear();
+    m_tree.clear();
+}
+
+void WrapIndex::build() {
+    auto count = m_breaks.size();
+    m_tree.fill(0, count + 1);
+    for (auto i = 1; i <= count; ++i) {
+        m_tree[i] += m_breaks[i - 1].size() + 1;
+        auto parent = i + (i & -i);
+        if (parent <= count) m_tree[parent] += m_tree[i];
+    }
+}
+
+void WrapIndex::add(int line, int delta) {
+    if (delta == 0) return;
+    for (auto i = line + 1; i < m_tree.size(); i += i & -i) {
+        m_tree[i] += delta;
+    }
+}
+
+int WrapIndex::prefix(int count) const {
+    auto sum = 0;
+    for (auto i = qMin(count, m_tree.size() - 1); i > 0; i -= i & -i) {
+        sum += m_tree[i];
+    }
+    return sum;
+}
+
+int WrapIndex::rows() const {
+    return prefix(m_breaks.size());
+}
+
+int WrapIndex::rowCount(int line) const {
+    if (line < 0 || line >= m_breaks.size()) return 1;
+    return m_breaks[line].size() + 1;
+}
+
+int WrapIndex::rowOf(int line) const {
+    auto count = m_breaks.size();
+    if (line <= count) return prefix(line);
+    return prefix(count) + (line - count);
+}
+
+int WrapIndex::lineAt(int row) const {
+    auto count = m_breaks.size();
+    auto line = 0;
+    auto rest = qMax(0, row);
+    auto step = 1;
+    while (step * 2 <= count) {
+        step *= 2;
+    }
+    for (; count > 0 && step > 0; step /= 2) {
+        if (line + step <= count && m_tree[line + step] <= rest) {
+            line += step;
+            rest -= m_tree[line];
+        }
+    }
+    // rest is the row inside line, or rows past the end
+    return line < count ? line : count + rest;
+}
+
+QVector<int> WrapIndex::breaks(int line) const {
+    if (line < 0 || line >= m_breaks.size()) return QVector<int>();
+    return m_breaks[line];
+}
+
+int WrapIndex::subRowOf(int line, int ix) const {
+    if (line < 0 || line >= m_breaks.size()) return 0;
+    const auto &breaks = m_breaks[line];
+    return int(std::upper_bound(breaks.begin(), breaks.end(), ix) - breaks.begin());
+}
+
+} // namespace xi
@@ -0,0 +1,61 @@
+#ifndef WRAP_INDEX_H
+#define WRAP_INDEX_H
+
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "line_cache.h"
+
+namespace xi {
+
+// Soft wrap of a document into visual rows. Wrap points come from monospace
+// column arithmetic; rows per line are kept in a Fenwick tree so row <-> line
+// lookups are O(log n). Lines past the synced ones count as one row each.
+class WrapIndex {
+public:
+    inline int columns() const {
+        return m_columns;
+    }
+    inline int lineCount() const {
+        return m_lines.size();
+    }
+
+    // rewraps only lines whose Line object changed; a new column count rewraps all
+    void sync(const CacheLines &lines, int columns);
+    // line ix replaced in place, a point update of its rows
+    void update(int ix, const std::shared_ptr<Line> &line);
+    // lines inserted, removed or moved: copied runs keep their wrap, only new
+    // lines are fetched from lineAt and wrapped
+    void move(const QVector<LineMove> &moves, const std::function<std::shared_ptr<Line>(int)> &lineAt);
+    void clear();
+
+    int rows() const;
+    int rowCount(int line) const;
+    // first visual row of line
+    int rowOf(int line) const;
+    // line containing visual row
+    int lineAt(int row) const;
+    // utf16 offsets where the second and following rows of line start
+    QVector<int> breaks(int line) const;
+    // rows of line before the one holding utf16 offset ix
+    int subRowOf(int line, int ix) const;
+
+    // greedy word wrap at columns utf16 units, hard breaks inside long words
+    static QVector<int> wrap(const QString &text, int columns);
+
+private:
+    void build();
+    void add(int line, int delta);
+    int prefix(int count) const;
+
+    int m_columns = 0;
+    CacheLines m_lines; // what m_breaks was computed from
+    QVector<QVector<int>> m_breaks;
+    QVector<int> m_tree; // 1-based Fenwick tree of rows per line
+};
+
+} // namespace xi
+
+#endif // WRAP_INDEX_H
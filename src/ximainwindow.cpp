@@ -76,6 +76,7 @@ void XiMainWindow::closeEvent(QCloseEvent *event) {
     Q_UNUSED(event);
 
     // notify save
+    m_editWindow->saveAllSnapshots();
 
     // exit core process
      m_coreConnection->uninit();